@@ -41,18 +41,46 @@
 
 #include "uiquickcompletionmodel_p.h"
 
-#include <UiHelpers/UiStandardItemModel>
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QStringList>
+#include <QtCore/QTimer>
 
-class WrapperModel : public UiStandardItemModel
+// Read only model over the strings of a list source, sharing their data
+class WrapperModel : public QAbstractListModel
 {
 public:
     enum WrapperRoles { ModelDataRole };
 
-    WrapperModel() {
+    WrapperModel(QObject *parent = 0) : QAbstractListModel(parent) {
         QHash<int, QByteArray> roleNames;
         roleNames[WrapperModel::ModelDataRole] = "modelData";
         setRoleNames(roleNames);
     }
+
+    void setStrings(const QStringList &strings) {
+        beginResetModel();
+        m_strings = strings;
+        endResetModel();
+    }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const {
+        return parent.isValid() ? 0 : m_strings.count();
+    }
+
+    QVariant data(const QModelIndex &index, int role) const {
+        if (!index.isValid() || index.row() >= m_strings.count())
+            return QVariant();
+        if (role == ModelDataRole)
+            return m_strings.at(index.row());
+        return QVariant();
+    }
+
+    Qt::ItemFlags flags(const QModelIndex &index) const {
+        return index.isValid() ? Qt::ItemIsSelectable : Qt::NoItemFlags;
+    }
+
+private:
+    QStringList m_strings;
 };
 
 
@@ -66,11 +94,18 @@ public:
 
     UiQuickCompletionModel *q_ptr;
     QVariant source;
+    WrapperModel *wrapper;
+
+    // runs while a new completion prefix waits to be filtered
+    QTimer filterTimer;
 };
 
 UiQuickCompletionModelPrivate::UiQuickCompletionModelPrivate(UiQuickCompletionModel *q)
     : q_ptr(q)
+    , wrapper(0)
 {
+    filterTimer.setSingleShot(true);
+    filterTimer.setInterval(0);
 }
 
 UiQuickCompletionModelPrivate::~UiQuickCompletionModelPrivate()
@@ -82,6 +117,8 @@ UiQuickCompletionModel::UiQuickCompletionModel(QObject *parent)
     : UiCompletionModel(parent)
     , d_ptr(new UiQuickCompletionModelPrivate(this))
 {
+    Q_D(UiQuickCompletionModel);
+    connect(&d->filterTimer, SIGNAL(timeout()), this, SLOT(applyCompletionPrefix()));
 }
 
 UiQuickCompletionModel::~UiQuickCompletionModel()
@@ -100,19 +137,62 @@ void UiQuickCompletionModel::setSource(const QVariant& source)
     if (source == d->source)
         return;
 
-    if (source.type() == QVariant::List) {
-        WrapperModel *wrapper = new WrapperModel();
-        foreach (const QVariant& var, source.toList()) {
-            UiStandardItem *item = new UiStandardItem();
-            item->setData(var.toString(), WrapperModel::ModelDataRole);
-            item->setFlags(Qt::ItemIsSelectable);
-            wrapper->appendRow(item);
+    if (source.type() == QVariant::List || source.type() == QVariant::StringList) {
+        // a single wrapper is reset with the new strings, string lists are
+        // adopted as they are and list entries share their string data;
+        // the reset still has the completion index copy every string
+        if (!d->wrapper)
+            d->wrapper = new WrapperModel(this);
+        d->wrapper->setStrings(source.toStringList());
+        if (sourceModel() != d->wrapper) {
+            setSourceModel(d->wrapper);
+            setCompletionRole(WrapperModel::ModelDataRole);
         }
-
-        setSourceModel(wrapper);
-        setCompletionRole(WrapperModel::ModelDataRole);
     }
 
     d->source = source;
     emit sourceModelChanged();
 }
+
+/*
+    With a filterDelay, the prefixes set while the delay runs are coalesced:
+    the delay starts with the first of them and only the last one is
+    filtered when it ends, so results keep coming while the user types.
+*/
+void UiQuickCompletionModel::filterPrefix()
+{
+    Q_D(UiQuickCompletionModel);
+    if (d->filterTimer.interval() <= 0) {
+        UiCompletionModel::filterPrefix();
+        return;
+    }
+
+    if (!d->filterTimer.isActive())
+        d->filterTimer.start();
+}
+
+void UiQuickCompletionModel::applyCompletionPrefix()
+{
+    UiCompletionModel::filterPrefix();
+}
+
+int UiQuickCompletionModel::filterDelay() const
+{
+    Q_D(const UiQuickCompletionModel);
+    return d->filterTimer.interval();
+}
+
+void UiQuickCompletionModel::setFilterDelay(int delay)
+{
+    Q_D(UiQuickCompletionModel);
+    delay = qMax(delay, 0);
+    if (delay == d->filterTimer.interval())
+        return;
+
+    d->filterTimer.setInterval(delay);
+    if (delay == 0 && d->filterTimer.isActive()) {
+        d->filterTimer.stop();
+        applyCompletionPrefix();
+    }
+    emit filterDelayChanged();
+}
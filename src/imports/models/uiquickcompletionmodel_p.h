@@ -52,6 +52,7 @@ class UiQuickCompletionModel : public UiCompletionModel
     Q_OBJECT
 
     Q_PROPERTY(QVariant sourceModel READ source WRITE setSource NOTIFY sourceModelChanged)
+    Q_PROPERTY(int filterDelay READ filterDelay WRITE setFilterDelay NOTIFY filterDelayChanged)
 
 public:
     UiQuickCompletionModel(QObject *parent = 0);
@@ -60,8 +61,18 @@ public:
     QVariant source() const;
     void setSource(const QVariant &source);
 
+    int filterDelay() const;
+    void setFilterDelay(int delay);
+
+protected:
+    void filterPrefix();
+
 Q_SIGNALS:
     void sourceModelChanged();
+    void filterDelayChanged();
+
+private Q_SLOTS:
+    void applyCompletionPrefix();
 
 private:
     Q_DISABLE_COPY(UiQuickCompletionModel)
@@ -4,6 +4,7 @@ HEADERS += \
     $$PWD/uifilesystemmodel.h \
     $$PWD/uifilesystemmodel_p.h \
     $$PWD/uifileinfogatherer_p.h \
+    $$PWD/uiinotifywatcher_p.h \
     $$PWD/uicompletionmodel.h \
     $$PWD/uicompletionmodel_p.h \
     $$PWD/uistandarditemmodel.h \
@@ -14,6 +15,7 @@ HEADERS += \
 SOURCES += \
     $$PWD/uifilesystemmodel.cpp \
     $$PWD/uifileinfogatherer.cpp \
+    $$PWD/uiinotifywatcher.cpp \
     $$PWD/uicompletionmodel.cpp \
     $$PWD/uistandarditemmodel.cpp \
     $$PWD/uitextfilemodel.cpp
@@ -45,9 +45,99 @@
 #include "uicompletionmodel_p.h"
 #include "QtCore/qstringlistmodel.h"
 #include "QtCore/qdir.h"
+#include "QtCore/qfile.h"
+#include "QtCore/qdatastream.h"
+#include "QtCore/qdatetime.h"
+#include "QtCore/qmath.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define UI_COMPLETION_SSE2
+#endif
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define UI_COMPLETION_AVX2
+#endif
 
 QT_BEGIN_NAMESPACE_UIHELPERS
 
+/*
+    Completion indexes are built once per source model, parent, column and
+    role, and shared by every completion model that asks for them. The
+    registry only keeps weak references; the engines own the indexes.
+
+    Each source has a generation that is advanced on the first change
+    notification a completion model sees for it. Indexes built for an older
+    generation are never handed out again, so the models that get the same
+    notification later find the index rebuilt by the first one.
+*/
+struct UiCompletionIndexKey
+{
+    const QAbstractItemModel *model;
+    QModelIndex parent;
+    int column;
+    int role;
+
+    bool operator==(const UiCompletionIndexKey &other) const
+    {
+        return model == other.model && parent == other.parent
+            && column == other.column && role == other.role;
+    }
+};
+
+static inline uint qHash(const UiCompletionIndexKey &key)
+{
+    return QT_PREPEND_NAMESPACE(qHash)(key.model) ^ QT_PREPEND_NAMESPACE(qHash)(key.parent)
+        ^ uint(key.column) ^ (uint(key.role) << 16);
+}
+
+class UiCompletionIndexRegistry
+{
+public:
+    UiCompletionIndexPointer find(const UiCompletionIndexKey &key) const
+    {
+        const Entry entry = entries.value(key);
+        if (entry.generation != generation(key.model))
+            return UiCompletionIndexPointer();
+        return entry.index.toStrongRef();
+    }
+
+    void insert(const UiCompletionIndexKey &key, const UiCompletionIndexPointer &index)
+    {
+        // drop the entries nobody holds anymore, building is linear anyway
+        QHash<UiCompletionIndexKey, Entry>::iterator it = entries.begin();
+        while (it != entries.end()) {
+            if (it.value().index.isNull())
+                it = entries.erase(it);
+            else
+                ++it;
+        }
+        Entry entry;
+        entry.index = index;
+        entry.generation = generation(key.model);
+        entries.insert(key, entry);
+    }
+
+    int generation(const QObject *model) const { return generations.value(model); }
+    void advance(const QObject *model) { ++generations[model]; }
+    void forget(const QObject *model) { generations.remove(model); }
+
+private:
+    struct Entry
+    {
+        Entry() : generation(0) { }
+        QWeakPointer<UiCompletionIndex> index;
+        int generation;
+    };
+
+    QHash<UiCompletionIndexKey, Entry> entries;
+    QHash<const QObject *, int> generations;
+};
+
+Q_GLOBAL_STATIC(UiCompletionIndexRegistry, sharedIndexes)
+
 UiCompletionModel::UiCompletionModel(QObject *parent)
     : QAbstractProxyModel(*new UiCompletionModelPrivate(this), parent)
 {
@@ -71,16 +161,18 @@ void UiCompletionModel::setSourceModel(QAbstractItemModel *source)
 
     if (source) {
         // TODO: Optimize updates in the source model
-        connect(source, SIGNAL(modelReset()), this, SLOT(invalidate()));
+        connect(source, SIGNAL(modelReset()), this, SLOT(_q_sourceChanged()));
         connect(source, SIGNAL(destroyed()), this, SLOT(modelDestroyed()));
-        connect(source, SIGNAL(layoutChanged()), this, SLOT(invalidate()));
+        connect(source, SIGNAL(layoutChanged()), this, SLOT(_q_sourceChanged()));
         connect(source, SIGNAL(rowsInserted(QModelIndex,int,int)), this, SLOT(rowsInserted()));
-        connect(source, SIGNAL(rowsRemoved(QModelIndex,int,int)), this, SLOT(invalidate()));
-        connect(source, SIGNAL(columnsInserted(QModelIndex,int,int)), this, SLOT(invalidate()));
-        connect(source, SIGNAL(columnsRemoved(QModelIndex,int,int)), this, SLOT(invalidate()));
-        connect(source, SIGNAL(dataChanged(QModelIndex,QModelIndex)), this, SLOT(invalidate()));
+        connect(source, SIGNAL(rowsRemoved(QModelIndex,int,int)), this, SLOT(_q_sourceChanged()));
+        connect(source, SIGNAL(columnsInserted(QModelIndex,int,int)), this, SLOT(_q_sourceChanged()));
+        connect(source, SIGNAL(columnsRemoved(QModelIndex,int,int)), this, SLOT(_q_sourceChanged()));
+        connect(source, SIGNAL(dataChanged(QModelIndex,QModelIndex)), this, SLOT(_q_sourceChanged()));
     }
 
+    Q_D(UiCompletionModel);
+    d->sourceGeneration = sharedIndexes()->generation(source);
     invalidate();
 }
 
@@ -97,7 +189,8 @@ void UiCompletionModel::createEngine()
         sortedEngine = d->cs == Qt::CaseSensitive;
         break;
     case CaseInsensitivelySortedModel:
-        sortedEngine = d->cs == Qt::CaseInsensitive;
+        // a case sensitive completer narrows the case insensitive range
+        sortedEngine = true;
         break;
     }
 
@@ -124,7 +217,7 @@ QModelIndex UiCompletionModel::mapToSource(const QModelIndex& index) const
             row = rootIndices[index.row()];
             parent = QModelIndex();
         } else {
-            row = d->engine->curMatch.indices[index.row() - rootIndices.count()];
+            row = d->engine->matchAt(index.row() - rootIndices.count());
         }
     } else {
         row = index.row();
@@ -156,11 +249,14 @@ QModelIndex UiCompletionModel::mapFromSource(const QModelIndex& idx) const
 
         if (row == -1) {
             QIndexMapper& indices = d->engine->curMatch.indices;
-            d->engine->filterOnDemand(idx.row() - indices.last());
-            row = indices.indexOf(idx.row()) + rootIndices.count();
+            if (idx.row() > indices.last())
+                d->engine->filterOnDemand(idx.row() - indices.last());
+            row = d->engine->matchPosition(idx.row());
+            if (row != -1)
+                row += rootIndices.count();
         }
 
-        if (row == -1)
+        if (row == -1 || (d->maxResults > 0 && row >= d->maxResults))
             return QModelIndex();
     } else {
         if (idx.parent() != d->engine->curParent)
@@ -174,7 +270,7 @@ QModelIndex UiCompletionModel::mapFromSource(const QModelIndex& idx) const
 bool UiCompletionModel::setCurrentRow(int row)
 {
     Q_D(UiCompletionModel);
-    if (row < 0 || !d->engine->matchCount())
+    if (row < 0 || !d->engine->matchCount() || (d->maxResults > 0 && row >= d->maxResults))
         return false;
 
     if (row >= d->engine->matchCount())
@@ -211,7 +307,7 @@ QModelIndex UiCompletionModel::index(int row, int column, const QModelIndex& par
         return QModelIndex();
 
     if (!d->showAll) {
-        if (!d->engine->matchCount())
+        if (!d->engine->matchCount() || (d->maxResults > 0 && row >= d->maxResults))
             return QModelIndex();
         if (row >= d->engine->historyMatch.indices.count()) {
             int want = row + 1 - d->engine->matchCount();
@@ -258,7 +354,7 @@ int UiCompletionModel::rowCount(const QModelIndex &parent) const
         return d->model->rowCount(d->engine->curParent);
     }
 
-    return completionCount();
+    return d->visibleCount();
 }
 
 void UiCompletionModel::setFiltered(bool filtered)
@@ -293,12 +389,15 @@ QVariant UiCompletionModel::data(const QModelIndex& index, int role) const
 
 void UiCompletionModel::modelDestroyed()
 {
+    sharedIndexes()->forget(sender());
     QAbstractProxyModel::setSourceModel(0); // switch to static empty model
     invalidate();
 }
 
 void UiCompletionModel::rowsInserted()
 {
+    Q_D(UiCompletionModel);
+    d->syncSharedIndexes();
     invalidate();
     emit rowsAdded();
 }
@@ -306,20 +405,194 @@ void UiCompletionModel::rowsInserted()
 void UiCompletionModel::invalidate()
 {
     Q_D(UiCompletionModel);
-    d->engine->cache.clear();
+    d->engine->clear();
+    d->forceReset = true;
     filter(d->engine->curParts);
 }
 
+// Stops handing out the shared indexes of the source, unless another model
+// already did so for the same change
+void UiCompletionModelPrivate::syncSharedIndexes()
+{
+    UiCompletionIndexRegistry *registry = sharedIndexes();
+    if (sourceGeneration == registry->generation(model))
+        registry->advance(model);
+    sourceGeneration = registry->generation(model);
+}
+
+void UiCompletionModelPrivate::_q_sourceChanged()
+{
+    Q_Q(UiCompletionModel);
+    syncSharedIndexes();
+    q->invalidate();
+}
+
 void UiCompletionModel::filter(const QStringList& parts)
 {
     Q_D(UiCompletionModel);
-    d->engine->filter(parts);
-    resetModel();
+    UiCompletionEngine *e = d->engine.data();
+
+    // Remember what the view shows, so that narrowing or widening the matches
+    // under the same parent can be announced as removed or inserted rows
+    const bool incremental = !d->forceReset && !d->showAll && !e->historyMatch.isValid();
+    const QModelIndex oldParent = e->curParent;
+    QVector<int> oldRows;
+    if (incremental)
+        oldRows = d->matchedRows();
+    d->forceReset = false;
+
+    e->filter(parts);
+    if (d->ranking)
+        d->rank();
+
+    if (!incremental || e->historyMatch.isValid() || e->curParent != oldParent
+        || !d->updateRows(oldRows))
+        resetModel();
 
     if (d->model->canFetchMore(d->engine->curParent))
         d->model->fetchMore(d->engine->curParent);
 }
 
+QVector<int> UiCompletionModelPrivate::matchedRows() const
+{
+    QVector<int> rows;
+    if (!engine->curMatch.isValid())
+        return rows;
+    const int count = visibleCount();
+    rows.reserve(count);
+    for (int i = 0; i < count; ++i)
+        rows.append(engine->matchAt(i));
+    return rows;
+}
+
+// Number of rows shown while filtering. With maxResults set, only that many
+// matches are ever looked for.
+int UiCompletionModelPrivate::visibleCount() const
+{
+    if (!engine->matchCount())
+        return 0;
+    if (maxResults <= 0) {
+        engine->filterOnDemand(INT_MAX);
+        return engine->matchCount();
+    }
+    const int missing = maxResults - engine->matchCount();
+    if (missing > 0)
+        engine->filterOnDemand(missing);
+    return qMin(engine->matchCount(), maxResults);
+}
+
+// Returns true if every element of sub appears in seq, in the same order
+static bool isSubsequence(const QVector<int> &sub, const QVector<int> &seq)
+{
+    int j = 0;
+    for (int i = 0; i < sub.count(); ++i) {
+        while (j < seq.count() && seq.at(j) != sub.at(i))
+            ++j;
+        if (j == seq.count())
+            return false;
+        ++j;
+    }
+    return true;
+}
+
+// Counts the runs of elements of seq that are missing from its subsequence sub
+static int missingRuns(const QVector<int> &sub, const QVector<int> &seq)
+{
+    int runs = 0;
+    bool inRun = false;
+    for (int i = 0, j = 0; j < seq.count(); ++j) {
+        const bool missing = i == sub.count() || sub.at(i) != seq.at(j);
+        if (!missing)
+            ++i;
+        if (missing && !inRun)
+            ++runs;
+        inRun = missing;
+    }
+    return runs;
+}
+
+// Beyond this many ranges a single reset is cheaper for the views
+static const int maxUpdateRuns = 32;
+
+/*
+    Moves the proxy from oldRows to the current matches with the smallest
+    ranges of removed or inserted rows. The matches are stepped through
+    intermediate states so that the proxy is consistent at every signal.
+    Returns false if the new matches neither narrow nor widen the old ones,
+    or if they do so in too many separate ranges.
+*/
+bool UiCompletionModelPrivate::updateRows(const QVector<int> &oldRows)
+{
+    Q_Q(UiCompletionModel);
+    const QVector<int> newRows = matchedRows();
+    const bool narrowing = isSubsequence(newRows, oldRows);
+    if (!narrowing && !isSubsequence(oldRows, newRows))
+        return false;
+    if (narrowing ? missingRuns(newRows, oldRows) > maxUpdateRuns
+                  : missingRuns(oldRows, newRows) > maxUpdateRuns)
+        return false;
+
+    // step through plain lists of rows, which already include the ranking
+    const QMatchData target = engine->curMatch;
+    const int targetRow = engine->curRow;
+    QVector<int> rankedRows;
+    QVector<int> sortedRankedRows;
+    rankedRows.swap(engine->rankedRows);
+    sortedRankedRows.swap(engine->sortedRankedRows);
+    engine->curMatch = QMatchData(QIndexMapper(oldRows), -1, false);
+    QIndexMapper &rows = engine->curMatch.indices;
+
+    if (narrowing) {
+        // mark the old positions that stay, then remove the others bottom up
+        QBitArray keep(oldRows.count());
+        for (int i = 0, j = 0; i < newRows.count(); ++i, ++j) {
+            while (oldRows.at(j) != newRows.at(i))
+                ++j;
+            keep.setBit(j);
+        }
+        int last = oldRows.count() - 1;
+        while (last >= 0) {
+            if (keep.testBit(last)) {
+                --last;
+                continue;
+            }
+            int first = last;
+            while (first > 0 && !keep.testBit(first - 1))
+                --first;
+            q->beginRemoveRows(QModelIndex(), first, last);
+            rows.remove(first, last - first + 1);
+            q->endRemoveRows();
+            last = first - 1;
+        }
+    } else {
+        // insert the new rows top down, each run at its final position
+        int j = 0;
+        int i = 0;
+        while (i < newRows.count()) {
+            if (j < oldRows.count() && newRows.at(i) == oldRows.at(j)) {
+                ++i;
+                ++j;
+                continue;
+            }
+            int last = i;
+            while (last + 1 < newRows.count()
+                   && (j == oldRows.count() || newRows.at(last + 1) != oldRows.at(j)))
+                ++last;
+            q->beginInsertRows(QModelIndex(), i, last);
+            for (int k = i; k <= last; ++k)
+                rows.insert(k, newRows.at(k));
+            q->endInsertRows();
+            i = last + 1;
+        }
+    }
+
+    engine->curMatch = target;
+    engine->curRow = targetRow;
+    engine->rankedRows.swap(rankedRows);
+    engine->sortedRankedRows.swap(sortedRankedRows);
+    return true;
+}
+
 void UiCompletionModel::resetModel()
 {
     beginResetModel();
@@ -354,8 +627,8 @@ void UiCompletionModel::resetModel()
     dynamically by inspecting the contents of the model.
 
     \b{Note:} The performance improvements described above cannot take place
-    when the completer's \l caseSensitivity is different to the case sensitivity
-    used by the model's when sorting.
+    when the model is sorted case sensitively but the completer's
+    \l caseSensitivity is Qt::CaseInsensitive.
 
     \sa setCaseSensitivity(), UiCompletionModel::ModelSorting
 */
@@ -392,8 +665,8 @@ Qt::CaseSensitivity UiCompletionModel::caseSensitivity() const
     dynamically by inspecting the contents of the model.
 
     \b{Note:} The performance improvements described above cannot take place
-    when the completer's \l caseSensitivity is different to the case sensitivity
-    used by the model's when sorting.
+    when the model is sorted case sensitively but the completer's
+    \l caseSensitivity is Qt::CaseInsensitive.
 
     \sa setCaseSensitivity(), UiCompletionModel::ModelSorting
 */
@@ -465,12 +738,27 @@ int UiCompletionModel::completionRole() const
 
     The completionModel() is updated to reflect the list of possible
     matches for \a prefix.
+
+    \sa filterPrefix()
 */
 void UiCompletionModel::setCompletionPrefix(const QString &prefix)
 {
     Q_D(UiCompletionModel);
     d->prefix = prefix;
-    filter(QStringList(prefix));
+    filterPrefix();
+}
+
+/*!
+    Called whenever the completion prefix is set, to filter the source model
+    for completionPrefix().
+
+    Reimplement this function to defer or coalesce filtering; the
+    completionPrefix() reported meanwhile is already the new one.
+*/
+void UiCompletionModel::filterPrefix()
+{
+    Q_D(UiCompletionModel);
+    filter(QStringList(d->prefix));
 }
 
 QString UiCompletionModel::completionPrefix() const
@@ -479,7 +767,428 @@ QString UiCompletionModel::completionPrefix() const
     return d->prefix;
 }
 
+/*!
+    \property UiCompletionModel::rankingEnabled
+    \brief whether matches are ordered by how often and how recently they were used
+
+    When enabled, the best scoring matches are moved to the front of the model,
+    ordered by score, and the remaining matches keep the order of the source model.
+    Usage is recorded with recordUsage() and can be kept across sessions with
+    saveUsage() and loadUsage().
+
+    By default, this property is false.
+
+    \sa rankedCount
+*/
+void UiCompletionModel::setRankingEnabled(bool enable)
+{
+    Q_D(UiCompletionModel);
+    if (d->ranking == enable)
+        return;
+    d->ranking = enable;
+    filter(d->engine->curParts);
+}
+
+bool UiCompletionModel::isRankingEnabled() const
+{
+    Q_D(const UiCompletionModel);
+    return d->ranking;
+}
+
+/*!
+    \property UiCompletionModel::rankedCount
+    \brief the maximum number of matches moved to the front when ranking
+
+    Only this many matches are sorted by score, so it is usually set to the
+    number of completions visible at once.
+
+    The default value is 10.
+
+    \sa rankingEnabled
+*/
+void UiCompletionModel::setRankedCount(int count)
+{
+    Q_D(UiCompletionModel);
+    if (d->rankedCount == count)
+        return;
+    d->rankedCount = count;
+    if (d->ranking)
+        filter(d->engine->curParts);
+}
+
+int UiCompletionModel::rankedCount() const
+{
+    Q_D(const UiCompletionModel);
+    return d->rankedCount;
+}
+
+/*!
+    \property UiCompletionModel::maxResults
+    \brief the maximum number of rows shown while filtering
+
+    Only the first maxResults matches become rows of the model, and on
+    unsorted models the search stops once that many are found, so the cost
+    of a new completion prefix stays bounded however many entries match it.
+    completionCount() still counts every match.
+
+    Setting the value to 0 or less shows every match, which is the default.
+
+    \sa completionCount()
+*/
+void UiCompletionModel::setMaxResults(int count)
+{
+    Q_D(UiCompletionModel);
+    if (d->maxResults == count)
+        return;
+    d->maxResults = count;
+    filter(d->engine->curParts);
+}
+
+int UiCompletionModel::maxResults() const
+{
+    Q_D(const UiCompletionModel);
+    return d->maxResults;
+}
+
+/*!
+    Records that the user accepted \a completion, which raises its rank
+    the next time the model is filtered.
+
+    \sa rankingEnabled, clearUsage()
+*/
+void UiCompletionModel::recordUsage(const QString &completion)
+{
+    Q_D(UiCompletionModel);
+    UiCompletionUsage &u = d->usage[completion];
+    ++u.count;
+    u.lastUsed = QDateTime::currentMSecsSinceEpoch();
+}
+
+/*!
+    Forgets all recorded usage.
+
+    \sa recordUsage()
+*/
+void UiCompletionModel::clearUsage()
+{
+    Q_D(UiCompletionModel);
+    d->usage.clear();
+    if (d->ranking)
+        filter(d->engine->curParts);
+}
+
+static const quint32 usageMagic = 0x55694355; // "UiCU"
+static const quint32 usageVersion = 1;
+// an empty completion, its count and the time it was last used
+static const int minUsageRecordSize = 4 + 4 + 8;
+
+/*!
+    Replaces the recorded usage with the one stored in \a fileName.
+    Returns false if the file could not be read.
+
+    \sa saveUsage()
+*/
+bool UiCompletionModel::loadUsage(const QString &fileName)
+{
+    Q_D(UiCompletionModel);
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 magic, version, count;
+    in >> magic >> version >> count;
+    if (in.status() != QDataStream::Ok || magic != usageMagic || version != usageVersion)
+        return false;
+
+    QHash<QString, UiCompletionUsage> usage;
+    // the count isn't validated yet, a corrupt one mustn't allocate more than the file could hold
+    usage.reserve(int(qMin<qint64>(count, file.size() / minUsageRecordSize)));
+    for (quint32 i = 0; i < count; ++i) {
+        QString completion;
+        UiCompletionUsage u;
+        in >> completion >> u.count >> u.lastUsed;
+        if (in.status() != QDataStream::Ok)
+            return false;
+        usage.insert(completion, u);
+    }
+
+    d->usage = usage;
+    if (d->ranking)
+        filter(d->engine->curParts);
+    return true;
+}
+
+/*!
+    Writes the recorded usage to \a fileName. Returns false on failure.
+
+    \sa loadUsage()
+*/
+bool UiCompletionModel::saveUsage(const QString &fileName) const
+{
+    Q_D(const UiCompletionModel);
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QDataStream out(&file);
+    out << usageMagic << usageVersion << quint32(d->usage.count());
+    QHash<QString, UiCompletionUsage>::const_iterator it = d->usage.constBegin();
+    for (; it != d->usage.constEnd(); ++it)
+        out << it.key() << it.value().count << it.value().lastUsed;
+    return out.status() == QDataStream::Ok;
+}
+
+// Usage counts lose half of their weight every week
+static qreal usageScore(const UiCompletionUsage &u, qint64 now)
+{
+    const qreal halfLife = 7 * 24 * 3600 * 1000.0;
+    const qreal age = qMax(qint64(0), now - u.lastUsed);
+    return u.count * qPow(0.5, age / halfLife);
+}
+
+static bool higherScore(const QPair<qreal, int> &s1, const QPair<qreal, int> &s2)
+{
+    return s1.first > s2.first || (s1.first == s2.first && s1.second < s2.second);
+}
+
+// Moves the best scoring matches to the front. Only the top rankedCount
+// matches are moved; the others keep their source order. The matches are
+// left as built, lazily if they are, and the ranked rows are laid over them.
+void UiCompletionModelPrivate::rank()
+{
+    UiCompletionEngine *e = engine.data();
+    if (showAll || usage.isEmpty() || rankedCount <= 0 || !e->curMatch.isValid())
+        return;
+
+    const UiCompletionIndex &index = e->completionIndex(e->curParent);
+    const QIndexMapper &matches = e->curMatch.indices;
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    QVector<QPair<qreal, int> > scored; // score and source row
+    if (!e->curMatch.partial && matches.count() <= usage.count()) {
+        for (int i = 0; i < matches.count(); ++i) {
+            const int row = matches[i];
+            QHash<QString, UiCompletionUsage>::const_iterator it = usage.constFind(index.string(row, false));
+            if (it != usage.constEnd())
+                scored.append(qMakePair(usageScore(it.value(), now), row));
+        }
+    } else {
+        // Fewer completions were used than there are matches, so find the
+        // used ones in the index instead of looking up every match
+        const bool fold = cs == Qt::CaseInsensitive;
+        const QString key = fold ? e->curParts.last().toCaseFolded() : e->curParts.last();
+        QHash<QString, UiCompletionUsage>::const_iterator it = usage.constBegin();
+        for (; it != usage.constEnd(); ++it) {
+            const int row = index.exactMatch(it.key(), false);
+            if (row == -1)
+                continue;
+            const int pos = matches.lowerBound(row);
+            const bool found = pos < matches.count() && matches[pos] == row;
+            // rows past the matches found so far match if they will be found later
+            const bool later = e->curMatch.partial && row > matches.last()
+                && index.startsWith(row, key, fold);
+            if (found || later)
+                scored.append(qMakePair(usageScore(it.value(), now), row));
+        }
+    }
+    if (scored.isEmpty())
+        return;
+
+    const int top = qMin(rankedCount, scored.count());
+    std::partial_sort(scored.begin(), scored.begin() + top, scored.end(), higherScore);
+
+    e->rankedRows.reserve(top);
+    for (int i = 0; i < top; ++i)
+        e->rankedRows.append(scored.at(i).second);
+    e->sortedRankedRows = e->rankedRows;
+    qSort(e->sortedRankedRows);
+
+    // every match takes at least one row, so this finds all the ranked rows
+    const int beyond = e->sortedRankedRows.last() - matches.last();
+    if (beyond > 0)
+        e->filterOnDemand(beyond);
+}
+
 //////////////////////////////////////////////////////////////////////////////
+#if defined(UI_COMPLETION_SSE2) || defined(UI_COMPLETION_AVX2)
+static inline int firstSetBit(uint mask)
+{
+#if defined(Q_CC_GNU)
+    return __builtin_ctz(mask);
+#else
+    int bit = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        ++bit;
+    }
+    return bit;
+#endif
+}
+#endif
+
+static inline bool equalUnits(const ushort *a, const ushort *b, int len)
+{
+    int i = 0;
+#ifdef UI_COMPLETION_SSE2
+    for (; i + 8 <= len; i += 8) {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(x, y)) != 0xffff)
+            return false;
+    }
+#endif
+    for (; i < len; ++i) {
+        if (a[i] != b[i])
+            return false;
+    }
+    return true;
+}
+
+// Writes the case folded str to dst, which has room for str.length() code units.
+// Folding a QString keeps its length today; should a future fold change it,
+// fold each code unit on its own rather than write past the shared offsets.
+static void foldUnits(ushort *dst, const QString &str)
+{
+    const QString f = str.toCaseFolded();
+    if (f.length() == str.length()) {
+        memcpy(dst, f.utf16(), f.length() * sizeof(ushort));
+        return;
+    }
+    const ushort *units = str.utf16();
+    for (int i = 0; i < str.length(); ++i)
+        dst[i] = QChar(units[i]).toCaseFolded().unicode();
+}
+
+void UiCompletionIndex::build(const QAbstractItemModel *model, const QModelIndex &parent,
+                              int column, int role, bool withFolded)
+{
+    const int rows = model->rowCount(parent);
+    data.clear();
+    folded.clear();
+    offsets.resize(rows + 1);
+    heads.resize(rows);
+    foldedHeads.resize(withFolded ? rows : 0);
+    selectable.resize(rows);
+
+    for (int i = 0; i < rows; ++i) {
+        const QModelIndex idx = model->index(i, column, parent);
+        const QString str = model->data(idx, role).toString();
+        offsets[i] = data.count();
+        heads[i] = str.isEmpty() ? 0 : str.at(0).unicode();
+        selectable.setBit(i, model->flags(idx) & Qt::ItemIsSelectable);
+        data.resize(data.count() + str.length());
+        memcpy(data.data() + offsets.at(i), str.utf16(), str.length() * sizeof(ushort));
+        if (withFolded) {
+            // the folded copy shares the offsets of data
+            folded.resize(data.count());
+            foldUnits(folded.data() + offsets.at(i), str);
+            foldedHeads[i] = str.isEmpty() ? 0 : folded.at(offsets.at(i));
+        }
+    }
+    offsets[rows] = data.count();
+    data.squeeze();
+    folded.squeeze();
+}
+
+// Adds the case folded shadow to an index built without it
+void UiCompletionIndex::buildFolded()
+{
+    const int rows = count();
+    folded.resize(data.count());
+    foldedHeads.resize(rows);
+    for (int i = 0; i < rows; ++i) {
+        foldUnits(folded.data() + offsets.at(i), string(i, false));
+        foldedHeads[i] = length(i) ? folded.at(offsets.at(i)) : 0;
+    }
+}
+
+// Returns the first row in [from, to] whose first code unit is c, or to + 1.
+// Compares 16 (AVX2) or 8 (SSE2) candidates per instruction when available.
+int UiCompletionIndex::findHead(int from, int to, ushort c, bool fold) const
+{
+    const ushort *h = fold ? foldedHeads.constData() : heads.constData();
+    int i = from;
+#ifdef UI_COMPLETION_AVX2
+    const __m256i wide = _mm256_set1_epi16(short(c));
+    for (; i + 16 <= to + 1; i += 16) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(h + i));
+        const uint mask = uint(_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, wide)));
+        if (mask)
+            return i + (firstSetBit(mask) >> 1);
+    }
+#endif
+#ifdef UI_COMPLETION_SSE2
+    const __m128i narrow = _mm_set1_epi16(short(c));
+    for (; i + 8 <= to + 1; i += 8) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + i));
+        const uint mask = uint(_mm_movemask_epi8(_mm_cmpeq_epi16(v, narrow)));
+        if (mask)
+            return i + (firstSetBit(mask) >> 1);
+    }
+#endif
+    for (; i <= to; ++i) {
+        if (h[i] == c)
+            return i;
+    }
+    return to + 1;
+}
+
+// All comparisons are ordinal; pass a case folded key together with fold = true
+// to get the same results as Qt::CaseInsensitive
+bool UiCompletionIndex::startsWith(int row, const QString &prefix, bool fold) const
+{
+    const int len = prefix.length();
+    return length(row) >= len && equalUnits(candidate(row, fold), prefix.utf16(), len);
+}
+
+bool UiCompletionIndex::equals(int row, const QString &str, bool fold) const
+{
+    return length(row) == str.length() && startsWith(row, str, fold);
+}
+
+int UiCompletionIndex::compare(int row, const QString &key, bool fold) const
+{
+    const ushort *a = candidate(row, fold);
+    const ushort *b = key.utf16();
+    const int la = length(row);
+    const int lb = key.length();
+    const int l = qMin(la, lb);
+    for (int i = 0; i < l; ++i) {
+        if (a[i] != b[i])
+            return int(a[i]) - int(b[i]);
+    }
+    return la - lb;
+}
+
+QString UiCompletionIndex::string(int row, bool fold) const
+{
+    return QString(reinterpret_cast<const QChar *>(candidate(row, fold)), length(row));
+}
+
+qint64 UiCompletionIndex::memoryCost() const
+{
+    return qint64(data.capacity() + folded.capacity() + heads.capacity() + foldedHeads.capacity()) * sizeof(ushort)
+        + qint64(offsets.capacity()) * sizeof(int) + selectable.size() / 8
+        + qint64(exactRows.count() + foldedExactRows.count()) * (sizeof(void *) * 3 + sizeof(int));
+}
+
+// Returns the first selectable row whose string is key, or -1
+int UiCompletionIndex::exactMatch(const QString &key, bool fold) const
+{
+    QHash<QString, int> &rows = fold ? foldedExactRows : exactRows;
+    bool &built = fold ? foldedExactRowsBuilt : exactRowsBuilt;
+    if (!built) {
+        built = true;
+        rows.reserve(count());
+        for (int row = count() - 1; row >= 0; --row) {
+            if (isSelectable(row))
+                rows.insert(string(row, fold), row);
+        }
+    }
+    return rows.value(key, -1);
+}
+
 void UiCompletionEngine::filter(const QStringList& parts)
 {
     const QAbstractItemModel *model = c->proxy->sourceModel();
@@ -490,18 +1199,34 @@ void UiCompletionEngine::filter(const QStringList& parts)
     curRow = -1;
     curParent = QModelIndex();
     curMatch = QMatchData();
+    rankedRows.clear();
+    sortedRankedRows.clear();
     historyMatch = filterHistory();
 
     if (!model)
         return;
 
+    // Resolve the leading components by exact lookups, reusing the parents
+    // found on the previous call while the user only edits the last one
     QModelIndex parent;
+    const bool fold = c->cs == Qt::CaseInsensitive;
     for (int i = 0; i < curParts.count() - 1; i++) {
         QString part = curParts[i];
-        int emi = filter(part, parent, -1).exactMatchIndex;
+        if (i < resolvedParts.count() && resolvedParts.at(i) == part
+            && resolvedParents.at(i).isValid()) {
+            parent = resolvedParents.at(i);
+            continue;
+        }
+        while (resolvedParts.count() > i) {
+            resolvedParts.removeLast();
+            resolvedParents.removeLast();
+        }
+        int emi = completionIndex(parent).exactMatch(fold ? part.toCaseFolded() : part, fold);
         if (emi == -1)
             return;
         parent = model->index(emi, c->column, parent);
+        resolvedParts.append(part);
+        resolvedParents.append(parent);
     }
 
     // Note that we set the curParent to a valid parent, even if we have no matches
@@ -514,22 +1239,43 @@ void UiCompletionEngine::filter(const QStringList& parts)
     curRow = curMatch.isValid() ? 0 : -1;
 }
 
+// Top level rows matching the completion prefix. They are searched in the
+// same packed index as the completions under the root, and the previous
+// result is narrowed down while the prefix only grows.
 QMatchData UiCompletionEngine::filterHistory()
 {
     QAbstractItemModel *source = c->proxy->sourceModel();
     if (curParts.count() <= 1 || c->showAll || !source)
         return QMatchData();
 
-    QVector<int> v;
-    QIndexMapper im(v);
-    QMatchData m(im, -1, true);
-
-    for (int i = 0; i < source->rowCount(); i++) {
-        QString str = source->index(i, c->column).data().toString();
-        if (str.startsWith(c->prefix, c->cs))
-            m.indices.append(i);
+    const bool fold = c->cs == Qt::CaseInsensitive;
+    const QString key = fold ? c->prefix.toCaseFolded() : c->prefix;
+    const UiCompletionIndex &index = completionIndex(QModelIndex());
+
+    if (!historyValid || !key.startsWith(historyKey)) {
+        historyRows.clear();
+        const int last = index.count() - 1;
+        for (int row = 0; row <= last; ++row) {
+            if (!key.isEmpty()) {
+                row = index.findHead(row, last, key.at(0).unicode(), fold);
+                if (row > last)
+                    break;
+            }
+            if (index.startsWith(row, key, fold))
+                historyRows.append(row);
+        }
+    } else if (key != historyKey) {
+        QVector<int> rows;
+        for (int i = 0; i < historyRows.count(); ++i) {
+            if (index.startsWith(historyRows.at(i), key, fold))
+                rows.append(historyRows.at(i));
+        }
+        historyRows = rows;
     }
-    return m;
+    historyKey = key;
+    historyValid = true;
+
+    return QMatchData(QIndexMapper(historyRows), -1, true);
 }
 
 // Returns a match hint from the cache by chopping the search string
@@ -557,12 +1303,93 @@ bool UiCompletionEngine::lookupCache(QString part, const QModelIndex& parent, QM
    if (c->cs == Qt::CaseInsensitive)
         part = part.toLower();
    const CacheItem& map = cache[parent];
-   if (!map.contains(part))
+   if (!map.contains(part)) {
+#ifdef QT_BUILD_INTERNAL
+       ++cacheMisses;
+#endif
        return false;
+   }
+#ifdef QT_BUILD_INTERNAL
+   ++cacheHits;
+#endif
    *m = map[part];
    return true;
 }
 
+// Returns the source row of the i-th current match as shown, that is with
+// the ranked rows first and the other matches in their order after them
+int UiCompletionEngine::matchAt(int i) const
+{
+    const int ranked = rankedRows.count();
+    if (i < ranked)
+        return rankedRows.at(i);
+
+    // skip the ranked rows that come before the wanted one in the matches,
+    // which are in ascending order
+    const QIndexMapper &matches = curMatch.indices;
+    int pos = i - ranked;
+    for (int j = 0; j < ranked && sortedRankedRows.at(j) <= matches[pos]; ++j)
+        ++pos;
+    return matches[pos];
+}
+
+// Returns where the current match in source row is shown, or -1
+int UiCompletionEngine::matchPosition(int row) const
+{
+    const int ranked = rankedRows.indexOf(row);
+    if (ranked != -1)
+        return ranked;
+    const int pos = curMatch.indices.indexOf(row);
+    if (pos == -1)
+        return -1;
+    const int rankedBefore = qLowerBound(sortedRankedRows.constBegin(), sortedRankedRows.constEnd(), row)
+        - sortedRankedRows.constBegin();
+    return rankedRows.count() + pos - rankedBefore;
+}
+
+// Returns the packed copy of the completion column under parent, shared with
+// the other models completing from it, building it on first use.
+const UiCompletionIndex &UiCompletionEngine::completionIndex(const QModelIndex &parent)
+{
+    IndexMap::iterator it = indexes.find(parent);
+    if (it == indexes.end()) {
+        const bool withFolded = c->cs == Qt::CaseInsensitive
+            || c->sorting == UiCompletionModel::CaseInsensitivelySortedModel;
+        const UiCompletionIndexKey key = { c->proxy->sourceModel(), parent, c->column, c->role };
+        UiCompletionIndexPointer index = sharedIndexes()->find(key);
+        if (!index) {
+            index = UiCompletionIndexPointer(new UiCompletionIndex);
+            index->build(key.model, parent, c->column, c->role, withFolded);
+            sharedIndexes()->insert(key, index);
+        } else if (withFolded && !index->hasFolded()) {
+            index->buildFolded();
+        }
+        it = indexes.insert(parent, index);
+    }
+    return *it.value();
+}
+
+// Approximate number of bytes held by the match cache and the indexes,
+// including indexes shared with other models
+qint64 UiCompletionEngine::memoryCost() const
+{
+    qint64 bytes = qint64(cost) * sizeof(int);
+    for (IndexMap::const_iterator it = indexes.constBegin(); it != indexes.constEnd(); ++it)
+        bytes += it.value()->memoryCost();
+    return bytes;
+}
+
+void UiCompletionEngine::clear()
+{
+    cache.clear();
+    cost = 0;
+    indexes.clear();
+    resolvedParts.clear();
+    resolvedParents.clear();
+    historyValid = false;
+    historyRows.clear();
+}
+
 // When the cache size exceeds 1MB, it clears out about 1/2 of the cache.
 void UiCompletionEngine::saveInCache(QString part, const QModelIndex& parent, const QMatchData& m)
 {
@@ -637,30 +1464,44 @@ QIndexMapper QSortedModelEngine::indexHint(QString part, const QModelIndex& pare
     return QIndexMapper(from, to);
 }
 
-Qt::SortOrder QSortedModelEngine::sortOrder(const QModelIndex &parent) const
+// The rows are compared the way the model is sorted, which may be case
+// insensitive even though the completer is not
+bool QSortedModelEngine::foldedOrder() const
 {
-    const QAbstractItemModel *model = c->proxy->sourceModel();
+    return c->sorting == UiCompletionModel::CaseInsensitivelySortedModel;
+}
+
+Qt::SortOrder QSortedModelEngine::sortOrder(const QModelIndex &parent)
+{
+    const UiCompletionIndex &index = completionIndex(parent);
+    const bool fold = foldedOrder();
 
-    int rowCount = model->rowCount(parent);
+    int rowCount = index.count();
     if (rowCount < 2)
         return Qt::AscendingOrder;
-    QString first = model->data(model->index(0, c->column, parent), c->role).toString();
-    QString last = model->data(model->index(rowCount - 1, c->column, parent), c->role).toString();
-    return QString::compare(first, last, c->cs) <= 0 ? Qt::AscendingOrder : Qt::DescendingOrder;
+    return index.compare(0, index.string(rowCount - 1, fold), fold) <= 0 ? Qt::AscendingOrder : Qt::DescendingOrder;
 }
 
 QMatchData QSortedModelEngine::filter(const QString& part, const QModelIndex& parent, int)
 {
-    const QAbstractItemModel *model = c->proxy->sourceModel();
-
     QMatchData hint;
     if (lookupCache(part, parent, &hint))
         return hint;
 
+    const UiCompletionIndex &index = completionIndex(parent);
+    const bool fold = foldedOrder();
+    const QString key = fold ? part.toCaseFolded() : part;
+    // The model is sorted case insensitively but the completer is case
+    // sensitive: search the case insensitive range, then narrow it down.
+    // Cached results are not contiguous then, so they cannot bound the search.
+    const bool narrow = fold && c->cs == Qt::CaseSensitive;
+
     QIndexMapper indices;
     Qt::SortOrder order = sortOrder(parent);
 
-    if (matchHint(part, parent, &hint)) {
+    if (narrow) {
+        indices = QIndexMapper(0, index.count() - 1);
+    } else if (matchHint(part, parent, &hint)) {
         if (!hint.isValid())
             return QMatchData();
         indices = hint.indices;
@@ -672,15 +1513,11 @@ QMatchData QSortedModelEngine::filter(const QString& part, const QModelIndex& pa
     int high = indices.to() + 1;
     int low = indices.from() - 1;
     int probe;
-    QModelIndex probeIndex;
-    QString probeData;
 
     while (high - low > 1)
     {
         probe = (high + low) / 2;
-        probeIndex = model->index(probe, c->column, parent);
-        probeData = model->data(probeIndex, c->role).toString();
-        const int cmp = QString::compare(probeData, part, c->cs);
+        const int cmp = index.compare(probe, key, fold);
         if ((order == Qt::AscendingOrder && cmp >= 0)
             || (order == Qt::DescendingOrder && cmp < 0)) {
             high = probe;
@@ -695,15 +1532,14 @@ QMatchData QSortedModelEngine::filter(const QString& part, const QModelIndex& pa
         return QMatchData();
     }
 
-    probeIndex = model->index(order == Qt::AscendingOrder ? low+1 : high-1, c->column, parent);
-    probeData = model->data(probeIndex, c->role).toString();
-    if (!probeData.startsWith(part, c->cs)) {
+    probe = order == Qt::AscendingOrder ? low+1 : high-1;
+    if (!index.startsWith(probe, key, fold)) {
         saveInCache(part, parent, QMatchData());
         return QMatchData();
     }
 
-    const bool exactMatch = QString::compare(probeData, part, c->cs) == 0;
-    int emi =  exactMatch ? (order == Qt::AscendingOrder ? low+1 : high-1) : -1;
+    const bool exactMatch = index.equals(probe, key, fold);
+    int emi =  exactMatch ? probe : -1;
 
     int from = 0;
     int to = 0;
@@ -720,9 +1556,7 @@ QMatchData QSortedModelEngine::filter(const QString& part, const QModelIndex& pa
     while (high - low > 1)
     {
         probe = (high + low) / 2;
-        probeIndex = model->index(probe, c->column, parent);
-        probeData = model->data(probeIndex, c->role).toString();
-        const bool startsWith = probeData.startsWith(part, c->cs);
+        const bool startsWith = index.startsWith(probe, key, fold);
         if ((order == Qt::AscendingOrder && startsWith)
             || (order == Qt::DescendingOrder && !startsWith)) {
             low = probe;
@@ -732,6 +1566,19 @@ QMatchData QSortedModelEngine::filter(const QString& part, const QModelIndex& pa
     }
 
     QMatchData m(order == Qt::AscendingOrder ? QIndexMapper(from, high - 1) : QIndexMapper(low+1, to), emi, false);
+    if (narrow) {
+        QVector<int> rows;
+        emi = -1;
+        for (int i = 0; i < m.indices.count(); ++i) {
+            const int row = m.indices[i];
+            if (!index.startsWith(row, part, false))
+                continue;
+            rows.append(row);
+            if (emi == -1 && index.equals(row, part, false))
+                emi = row;
+        }
+        m = rows.isEmpty() ? QMatchData() : QMatchData(QIndexMapper(rows), emi, false);
+    }
     saveInCache(part, parent, m);
     return m;
 }
@@ -742,20 +1589,31 @@ int QUnsortedModelEngine::buildIndices(const QString& str, const QModelIndex& pa
 {
     Q_ASSERT(m->partial);
     Q_ASSERT(n != -1 || m->exactMatchIndex == -1);
-    const QAbstractItemModel *model = c->proxy->sourceModel();
+    const UiCompletionIndex &index = completionIndex(parent);
+    const bool fold = c->cs == Qt::CaseInsensitive;
+    const QString key = fold ? str.toCaseFolded() : str;
     int i, count = 0;
 
+    // Over a contiguous range, skip straight to the next candidate whose first
+    // character can match instead of testing the rows one by one
+    const bool scanHeads = indices.isRange() && !key.isEmpty();
+
     for (i = 0; i < indices.count() && count != n; ++i) {
-        QModelIndex idx = model->index(indices[i], c->column, parent);
-        QString data = model->data(idx, c->role).toString();
-        if (!data.startsWith(str, c->cs) || !(model->flags(idx) & Qt::ItemIsSelectable))
+        if (scanHeads) {
+            const int row = index.findHead(indices[i], indices.last(), key.at(0).unicode(), fold);
+            i += row - indices[i];
+            if (i >= indices.count())
+                break;
+        }
+        const int row = indices[i];
+        if (!index.startsWith(row, key, fold) || !index.isSelectable(row))
             continue;
-        m->indices.append(indices[i]);
+        m->indices.append(row);
         ++count;
-        if (m->exactMatchIndex == -1 && QString::compare(data, str, c->cs) == 0) {
-            m->exactMatchIndex = indices[i];
+        if (m->exactMatchIndex == -1 && index.equals(row, key, fold)) {
+            m->exactMatchIndex = row;
             if (n == -1)
-                return indices[i];
+                return row;
         }
     }
     return indices[i-1];
@@ -68,6 +68,9 @@ class UIHELPERS_EXPORT UiCompletionModel : public QAbstractProxyModel
     Q_PROPERTY(int completionColumn READ completionColumn WRITE setCompletionColumn)
     Q_PROPERTY(int completionRole READ completionRole WRITE setCompletionRole)
     Q_PROPERTY(QString completionPrefix READ completionPrefix WRITE setCompletionPrefix)
+    Q_PROPERTY(bool rankingEnabled READ isRankingEnabled WRITE setRankingEnabled)
+    Q_PROPERTY(int rankedCount READ rankedCount WRITE setRankedCount)
+    Q_PROPERTY(int maxResults READ maxResults WRITE setMaxResults)
 
 public:
     enum ModelSorting {
@@ -96,6 +99,17 @@ public:
     int completionRole() const;
     QString completionPrefix() const;
 
+    void setRankingEnabled(bool enable);
+    bool isRankingEnabled() const;
+    void setRankedCount(int count);
+    int rankedCount() const;
+    void setMaxResults(int count);
+    int maxResults() const;
+    Q_INVOKABLE void recordUsage(const QString &completion);
+    Q_INVOKABLE void clearUsage();
+    Q_INVOKABLE bool loadUsage(const QString &fileName);
+    Q_INVOKABLE bool saveUsage(const QString &fileName) const;
+
     QModelIndex index(int row, int column, const QModelIndex & = QModelIndex()) const;
     int rowCount(const QModelIndex &index = QModelIndex()) const;
     int columnCount(const QModelIndex &index = QModelIndex()) const;
@@ -111,6 +125,7 @@ public:
 
 protected:
     void createEngine();
+    virtual void filterPrefix();
 
 signals:
     void rowsAdded();
@@ -120,6 +135,9 @@ public Q_SLOTS:
     void rowsInserted();
     void modelDestroyed();
     void setCompletionPrefix(const QString &prefix);
+
+private:
+    Q_PRIVATE_SLOT(d_func(), void _q_sourceChanged())
 };
 
 QT_END_NAMESPACE_UIHELPERS
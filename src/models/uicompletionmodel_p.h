@@ -61,6 +61,11 @@
 #include "uicompletionmodel.h"
 #include "private/qabstractproxymodel_p.h"
 #include "QtCore/qstringlist.h"
+#include "QtCore/qbitarray.h"
+#include "QtCore/qvector.h"
+#include "QtCore/qalgorithms.h"
+#include "QtCore/qhash.h"
+#include "QtCore/qsharedpointer.h"
 
 QT_BEGIN_NAMESPACE_UIHELPERS
 
@@ -75,13 +80,20 @@ public:
     inline int operator[] (int index) const { return v ? vector[index] : f + index; }
     inline int indexOf(int x) const { return v ? vector.indexOf(x) : ((t < f) ? -1 : x - f); }
     inline bool isValid() const { return !isEmpty(); }
+    inline bool isRange() const { return !v; }
     inline bool isEmpty() const { return v ? vector.isEmpty() : (t < f); }
     inline void append(int x) { Q_ASSERT(v); vector.append(x); }
+    inline void insert(int i, int x) { Q_ASSERT(v); vector.insert(i, x); }
+    inline void remove(int i, int n) { Q_ASSERT(v); vector.remove(i, n); }
     inline int first() const { return v ? vector.first() : f; }
     inline int last() const { return v ? vector.last() : t; }
     inline int from() const { Q_ASSERT(!v); return f; }
     inline int to() const { Q_ASSERT(!v); return t; }
     inline int cost() const { return vector.count()+2; }
+    // position of the first index not less than x, for indices in ascending order
+    inline int lowerBound(int x) const
+    { return v ? int(qLowerBound(vector.constBegin(), vector.constEnd(), x) - vector.constBegin())
+               : qBound(0, x - f, count()); }
 
 private:
     bool v;
@@ -90,6 +102,52 @@ private:
 };
 
 
+// Packed UTF-16 copy of the completion column below one parent, laid out
+// so that prefix tests can run over many candidates at a time. When needed,
+// a case folded shadow copy lets case insensitive matching and searching run
+// as plain ordinal comparisons.
+class UiCompletionIndex
+{
+public:
+    UiCompletionIndex() : exactRowsBuilt(false), foldedExactRowsBuilt(false) { }
+
+    void build(const QAbstractItemModel *model, const QModelIndex &parent, int column, int role,
+               bool withFolded);
+    void buildFolded();
+
+    inline int count() const { return heads.count(); }
+    inline bool hasFolded() const { return foldedHeads.count() == heads.count(); }
+    inline const ushort *candidate(int row, bool fold) const
+    { Q_ASSERT(!fold || hasFolded()); return (fold ? folded.constData() : data.constData()) + offsets.at(row); }
+    inline int length(int row) const { return offsets.at(row + 1) - offsets.at(row); }
+    inline bool isSelectable(int row) const { return selectable.testBit(row); }
+
+    int findHead(int from, int to, ushort c, bool fold) const;
+    bool startsWith(int row, const QString &prefix, bool fold) const;
+    bool equals(int row, const QString &str, bool fold) const;
+    int compare(int row, const QString &key, bool fold) const;
+    QString string(int row, bool fold) const;
+    int exactMatch(const QString &key, bool fold) const;
+    qint64 memoryCost() const;
+
+private:
+    QVector<ushort> data;        // all candidates back to back
+    QVector<ushort> folded;      // case folded shadow of data, if built
+    QVector<int> offsets;        // start of each candidate in data, plus the end
+    QVector<ushort> heads;       // first code unit of each candidate, 0 if empty
+    QVector<ushort> foldedHeads;
+    QBitArray selectable;
+
+    // first selectable row for each string, built on the first exact lookup
+    mutable QHash<QString, int> exactRows;
+    mutable QHash<QString, int> foldedExactRows;
+    mutable bool exactRowsBuilt;
+    mutable bool foldedExactRowsBuilt;
+};
+
+typedef QSharedPointer<UiCompletionIndex> UiCompletionIndexPointer;
+
+
 struct QMatchData {
     QMatchData() : exactMatchIndex(-1) { }
     QMatchData(const QIndexMapper& indices, int em, bool p) :
@@ -106,8 +164,14 @@ class UiCompletionEngine
 public:
     typedef QMap<QString, QMatchData> CacheItem;
     typedef QMap<QModelIndex, CacheItem> Cache;
-
-    UiCompletionEngine(UiCompletionModelPrivate *c) : c(c), curRow(-1), cost(0) { }
+    typedef QMap<QModelIndex, UiCompletionIndexPointer> IndexMap;
+
+    UiCompletionEngine(UiCompletionModelPrivate *c)
+        : c(c), curRow(-1), historyValid(false), cost(0)
+#ifdef QT_BUILD_INTERNAL
+        , cacheHits(0), cacheMisses(0)
+#endif
+    { }
     virtual ~UiCompletionEngine() { }
 
     void filter(const QStringList &parts);
@@ -118,10 +182,16 @@ public:
     void saveInCache(QString, const QModelIndex&, const QMatchData&);
     bool lookupCache(QString part, const QModelIndex& parent, QMatchData *m);
 
+    const UiCompletionIndex &completionIndex(const QModelIndex &parent);
+    void clear();
+    qint64 memoryCost() const;
+
     virtual void filterOnDemand(int) { }
     virtual QMatchData filter(const QString&, const QModelIndex&, int) = 0;
 
     int matchCount() const { return curMatch.indices.count() + historyMatch.indices.count(); }
+    int matchAt(int i) const;
+    int matchPosition(int row) const;
 
     QMatchData curMatch, historyMatch;
     UiCompletionModelPrivate *c;
@@ -129,8 +199,29 @@ public:
     QModelIndex curParent;
     int curRow;
 
+    // matches moved to the front by ranking, in shown and in ascending order;
+    // they are always among the matches found so far
+    QVector<int> rankedRows;
+    QVector<int> sortedRankedRows;
+
+    // parents resolved for the leading path components of previous filter() calls
+    QStringList resolvedParts;
+    QList<QPersistentModelIndex> resolvedParents;
+
+    // last top level search of filterHistory()
+    QString historyKey;
+    QVector<int> historyRows;
+    bool historyValid;
+
     Cache cache;
     int cost;
+    IndexMap indexes; // shared with the models completing from the same column
+
+#ifdef QT_BUILD_INTERNAL
+    // statistics for the benchmarks, never reset
+    int cacheHits;
+    int cacheMisses;
+#endif
 };
 
 
@@ -140,7 +231,9 @@ public:
     QSortedModelEngine(UiCompletionModelPrivate *c) : UiCompletionEngine(c) { }
     QMatchData filter(const QString&, const QModelIndex&, int);
     QIndexMapper indexHint(QString, const QModelIndex&, Qt::SortOrder);
-    Qt::SortOrder sortOrder(const QModelIndex&) const;
+    Qt::SortOrder sortOrder(const QModelIndex&);
+private:
+    bool foldedOrder() const;
 };
 
 
@@ -157,13 +250,28 @@ private:
 };
 
 
+struct UiCompletionUsage {
+    UiCompletionUsage() : count(0), lastUsed(0) { }
+    quint32 count;
+    qint64 lastUsed; // msecs since epoch
+};
+
+
 class UiCompletionModelPrivate : public QAbstractProxyModelPrivate
 {
     Q_DECLARE_PUBLIC(UiCompletionModel)
 
 public:
     UiCompletionModelPrivate(UiCompletionModel *model) :
-        proxy(model), showAll(false), cs(Qt::CaseSensitive), role(Qt::EditRole), column(0), sorting(UiCompletionModel::UnsortedModel) { }
+        proxy(model), showAll(false), cs(Qt::CaseSensitive), role(Qt::EditRole), column(0), sorting(UiCompletionModel::UnsortedModel),
+        ranking(false), rankedCount(10), forceReset(false), sourceGeneration(0), maxResults(0) { }
+
+    void _q_sourceChanged();
+    void syncSharedIndexes();
+    void rank();
+    QVector<int> matchedRows() const;
+    int visibleCount() const;
+    bool updateRows(const QVector<int> &oldRows);
 
     UiCompletionModel *proxy;
     bool showAll;
@@ -173,6 +281,18 @@ public:
     int column;
     UiCompletionModel::ModelSorting sorting;
     QScopedPointer<UiCompletionEngine> engine;
+
+    bool ranking;
+    int rankedCount;
+    QHash<QString, UiCompletionUsage> usage;
+
+    // set when the source changed, so that old and new rows can't be compared
+    bool forceReset;
+
+    // generation of the shared indexes of the source this model has caught up with
+    int sourceGeneration;
+
+    int maxResults;
 };
 
 QT_END_NAMESPACE_UIHELPERS
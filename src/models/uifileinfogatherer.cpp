@@ -47,6 +47,12 @@
 #  include <unistd.h>
 #  include <sys/types.h>
 #endif
+#ifdef UI_GATHERER_DIRENT
+#  include <dirent.h>
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#endif
 #if defined(Q_OS_VXWORKS)
 #  include "qplatformdefs.h"
 #endif
@@ -68,13 +74,40 @@ Q_AUTOTEST_EXPORT bool qt_test_isFetchedRoot()
 }
 #endif
 
+/*
+    Reads directories from the queue of a gatherer, in parallel with the
+    gatherer thread itself
+*/
+class UiFileInfoGathererWorker : public QThread
+{
+public:
+    UiFileInfoGathererWorker(UiFileInfoGatherer *gatherer) : gatherer(gatherer) { }
+
+protected:
+    void run() { gatherer->processQueue(); }
+
+private:
+    UiFileInfoGatherer *gatherer;
+};
+
+// Directories are mostly waiting on the file system, so a few workers help
+// even on a single core, but too many would only thrash a local disk
+static int maxWorkers()
+{
+    return qBound(2, QThread::idealThreadCount(), 4);
+}
+
 /*!
     Creates thread
 */
 UiFileInfoGatherer::UiFileInfoGatherer(QObject *parent)
-    : QThread(parent), abort(false),
+    : QThread(parent), abort(false), serial(0), m_detailsOnDemand(false),
+      m_updateInterval(200),
 #ifndef QT_NO_FILESYSTEMWATCHER
       watcher(0),
+#endif
+#ifdef UI_INOTIFY_WATCHER
+      inotifyWatcher(0),
 #endif
       m_resolveSymlinks(false)
 {
@@ -88,8 +121,26 @@ UiFileInfoGatherer::UiFileInfoGatherer(QObject *parent)
     watcher = new QFileSystemWatcher(this);
     connect(watcher, SIGNAL(directoryChanged(QString)), this, SLOT(list(QString)));
     connect(watcher, SIGNAL(fileChanged(QString)), this, SLOT(updateFile(QString)));
+#endif
+#ifdef UI_INOTIFY_WATCHER
+    inotifyWatcher = new UiInotifyWatcher(this);
+    if (inotifyWatcher->isValid()) {
+        connect(inotifyWatcher, SIGNAL(filesChanged(QString,QStringList)),
+                this, SLOT(fetchExtendedInformation(QString,QStringList)));
+        connect(inotifyWatcher, SIGNAL(filesRemoved(QString,QStringList)),
+                this, SIGNAL(filesRemoved(QString,QStringList)));
+        connect(inotifyWatcher, SIGNAL(directoryChanged(QString)), this, SLOT(list(QString)));
+    } else {
+        delete inotifyWatcher;
+        inotifyWatcher = 0;
+    }
 #endif
     start(LowPriority);
+    for (int i = 1; i < maxWorkers(); ++i) {
+        UiFileInfoGathererWorker *worker = new UiFileInfoGathererWorker(this);
+        workers.append(worker);
+        worker->start(LowPriority);
+    }
 }
 
 /*!
@@ -98,10 +149,13 @@ UiFileInfoGatherer::UiFileInfoGatherer(QObject *parent)
 UiFileInfoGatherer::~UiFileInfoGatherer()
 {
     QMutexLocker locker(&mutex);
-    abort = true;
-    condition.wakeOne();
+    abort.store(true);
+    condition.wakeAll();
     locker.unlock();
     wait();
+    foreach (UiFileInfoGathererWorker *worker, workers)
+        worker->wait();
+    qDeleteAll(workers);
 }
 
 void UiFileInfoGatherer::setResolveSymlinks(bool enable)
@@ -118,6 +172,45 @@ bool UiFileInfoGatherer::resolveSymlinks() const
     return m_resolveSymlinks;
 }
 
+/*
+    When enabled, directory listings only report the names and types of the
+    entries where that saves stat calls, and the size, modification time and
+    permissions of a file are fetched when it is explicitly asked for.
+*/
+void UiFileInfoGatherer::setDetailsOnDemand(bool enable)
+{
+    m_detailsOnDemand.store(enable);
+}
+
+bool UiFileInfoGatherer::detailsOnDemand() const
+{
+    return m_detailsOnDemand.load();
+}
+
+/*
+    Sets how often, in milliseconds, a directory being read reports the
+    entries found since its last report. Reports are held back up to
+    MaxBatchDelay times longer while the receiver hasn't handled the
+    previous ones, so that a huge directory doesn't flood its event loop.
+*/
+void UiFileInfoGatherer::setUpdateInterval(int msecs)
+{
+    m_updateInterval.store(qMax(0, msecs));
+}
+
+int UiFileInfoGatherer::updateInterval() const
+{
+    return m_updateInterval.load();
+}
+
+/*
+    Called by the receiver of updates() for each signal it handles.
+*/
+void UiFileInfoGatherer::updatesHandled()
+{
+    pendingUpdates.deref();
+}
+
 /*!
     Fetch extended information for all \a files in \a path
 
@@ -126,17 +219,82 @@ bool UiFileInfoGatherer::resolveSymlinks() const
 void UiFileInfoGatherer::fetchExtendedInformation(const QString &path, const QStringList &files)
 {
     QMutexLocker locker(&mutex);
-    // See if we already have this dir/file in our que
-    int loc = this->path.lastIndexOf(path);
-    while (loc > 0)  {
-        if (this->files.at(loc) == files) {
+    // See if we already have this dir/file in our queue
+    foreach (const RequestKey &key, queuedPaths.values(path)) {
+        const QStringList queued = requests.value(key).files;
+        // a queued listing fetches these files too, unless it leaves out details
+        if (queued.isEmpty() && !files.isEmpty() && !m_detailsOnDemand.load())
             return;
-        }
-        loc = this->path.lastIndexOf(path, loc - 1);
+        if (queued == files || (files.isEmpty() && !m_detailsOnDemand.load()))
+            dequeue(key); // replaced by the newer request below
+    }
+
+    Request request;
+    request.path = path;
+    request.files = files;
+    const RequestKey key(priority(path, files), -(++serial));
+    requests.insert(key, request);
+    queuedPaths.insert(path, key);
+    condition.wakeOne();
+}
+
+/*
+    Moves the requests for \a path ahead of all others, typically because it
+    is the directory a view shows. Only one path is prioritized at a time.
+*/
+void UiFileInfoGatherer::prioritize(const QString &path)
+{
+    QMutexLocker locker(&mutex);
+    if (priorityPath == path)
+        return;
+    const QString previous = priorityPath;
+    priorityPath = path;
+    requeue(previous);
+    requeue(path);
+}
+
+/*
+    Drops the queued listings of \a path, e.g. because the user navigated
+    away from it. Requests for single files stay queued, since the model
+    waits for their details. A request already being processed still
+    completes.
+*/
+void UiFileInfoGatherer::cancel(const QString &path)
+{
+    QMutexLocker locker(&mutex);
+    foreach (const RequestKey &key, queuedPaths.values(path)) {
+        if (requests.value(key).files.isEmpty())
+            dequeue(key);
+    }
+    if (priorityPath == path) {
+        priorityPath.clear();
+        requeue(path);
+    }
+}
+
+int UiFileInfoGatherer::priority(const QString &path, const QStringList &files) const
+{
+    if (path == priorityPath)
+        return PrioritizedRequest;
+    return files.isEmpty() ? ListingRequest : FilesRequest;
+}
+
+void UiFileInfoGatherer::dequeue(const RequestKey &key)
+{
+    queuedPaths.remove(requests.value(key).path, key);
+    requests.remove(key);
+}
+
+// Sorts the queued requests for path again after its priority changed
+void UiFileInfoGatherer::requeue(const QString &path)
+{
+    foreach (const RequestKey &key, queuedPaths.values(path)) {
+        const Request request = requests.take(key);
+        const RequestKey newKey(priority(path, request.files), key.second);
+        requests.insert(newKey, request);
+        queuedPaths.remove(path, key);
+        queuedPaths.insert(path, newKey);
     }
-    this->path.push(path);
-    this->files.push(files);
-    condition.wakeAll();
 }
 
 /*!
@@ -163,6 +321,10 @@ void UiFileInfoGatherer::clear()
     watcher->removePaths(watcher->files());
     watcher->removePaths(watcher->directories());
 #endif
+#ifdef UI_INOTIFY_WATCHER
+    if (inotifyWatcher)
+        inotifyWatcher->removePaths(inotifyWatcher->directories());
+#endif
 }
 
 /*
@@ -176,6 +338,10 @@ void UiFileInfoGatherer::removePath(const QString &path)
     QMutexLocker locker(&mutex);
     watcher->removePath(path);
 #endif
+#ifdef UI_INOTIFY_WATCHER
+    if (inotifyWatcher)
+        inotifyWatcher->removePath(path);
+#endif
 }
 
 /*
@@ -188,34 +354,62 @@ void UiFileInfoGatherer::list(const QString &directoryPath)
     fetchExtendedInformation(directoryPath, QStringList());
 }
 
+void UiFileInfoGatherer::run()
+{
+    processQueue();
+}
+
 /*
-    Until aborted wait to fetch a directory or files
+    Until aborted wait to fetch a directory or files. Runs in the gatherer
+    thread and in each worker.
 */
-void UiFileInfoGatherer::run()
+void UiFileInfoGatherer::processQueue()
 {
     forever {
-        bool updateFiles = false;
         QMutexLocker locker(&mutex);
-        if (abort) {
-            return;
-        }
-        if (this->path.isEmpty())
-            condition.wait(&mutex);
         QString path;
         QStringList list;
-        if (!this->path.isEmpty()) {
-            path = this->path.first();
-            list = this->files.first();
-            this->path.pop_front();
-            this->files.pop_front();
-            updateFiles = true;
-        }
+        while (!abort.load() && !takeRequest(&path, &list))
+            condition.wait(&mutex);
+        if (abort.load())
+            return;
+        busyPaths.insert(path);
         locker.unlock();
-        if (updateFiles)
-            getFileInfos(path, list);
+
+        getFileInfos(path, list);
+
+        locker.relock();
+        busyPaths.remove(path);
+        // requests for this directory may have been held back meanwhile
+        if (!requests.isEmpty())
+            condition.wakeOne();
     }
 }
 
+/*
+    Takes the first request for a directory that no other worker is reading,
+    so that the signals of one directory keep their order and a slow directory
+    only holds up its own requests. Requests for the prioritized path come
+    first, then those for single files, which are made for the rows a view is
+    showing, then whole listings; the newest first within each group.
+
+    Must be called with the mutex locked.
+*/
+bool UiFileInfoGatherer::takeRequest(QString *path, QStringList *files)
+{
+    QMap<RequestKey, Request>::iterator it = requests.begin();
+    while (it != requests.end() && busyPaths.contains(it.value().path))
+        ++it;
+    if (it == requests.end())
+        return false;
+
+    *path = it.value().path;
+    *files = it.value().files;
+    queuedPaths.remove(*path, it.key());
+    requests.erase(it);
+    return true;
+}
+
 UiExtendedInformation UiFileInfoGatherer::getInfo(const QFileInfo &fileInfo) const
 {
     UiExtendedInformation info(fileInfo);
@@ -246,6 +440,23 @@ UiExtendedInformation UiFileInfoGatherer::getInfo(const QFileInfo &fileInfo) con
     return info;
 }
 
+#ifndef QT_NO_FILESYSTEMWATCHER
+/*
+    Watches \a path with inotify where available, falling back to
+    QFileSystemWatcher, which only tells that the directory changed and so
+    has it listed again. Must be called with the mutex locked.
+*/
+void UiFileInfoGatherer::watchDirectory(const QString &path)
+{
+#ifdef UI_INOTIFY_WATCHER
+    if (inotifyWatcher && inotifyWatcher->addPath(path))
+        return;
+#endif
+    if (!watcher->directories().contains(path))
+        watcher->addPath(path);
+}
+#endif
+
 QString UiFileInfoGatherer::translateDriveName(const QFileInfo &drive) const
 {
     QString driveName = drive.absoluteFilePath();
@@ -259,8 +470,8 @@ QString UiFileInfoGatherer::translateDriveName(const QFileInfo &drive) const
 }
 
 /*
-    Get specific file info's, batch the files so update when we have 100
-    items and every 200ms after that
+    Get specific file info's, batch the files so update when we have
+    FirstBatchSize items and every update interval after that
  */
 void UiFileInfoGatherer::getFileInfos(const QString &path, const QStringList &files)
 {
@@ -269,8 +480,7 @@ void UiFileInfoGatherer::getFileInfos(const QString &path, const QStringList &fi
         && !path.isEmpty()
         && !path.startsWith(QLatin1String("//")) /*don't watch UNC path*/) {
         QMutexLocker locker(&mutex);
-        if (!watcher->directories().contains(path))
-            watcher->addPath(path);
+        watchDirectory(path);
     }
 #endif
 
@@ -286,55 +496,227 @@ void UiFileInfoGatherer::getFileInfos(const QString &path, const QStringList &fi
             for (int i = 0; i < files.count(); ++i)
                 infoList << QFileInfo(files.at(i));
         }
+        UpdateBatch batch(path);
         for (int i = infoList.count() - 1; i >= 0; --i) {
             QString driveName = translateDriveName(infoList.at(i));
-            QList<QPair<QString,QFileInfo> > updatedFiles;
-            updatedFiles.append(QPair<QString,QFileInfo>(driveName, infoList.at(i)));
-            emit updates(path, updatedFiles);
+            batch.files.append(QPair<QString, UiExtendedInformation>(driveName, getInfo(infoList.at(i))));
+            flush(batch);
         }
         return;
     }
 
-    QElapsedTimer base;
-    base.start();
     QFileInfo fileInfo;
-    bool firstTime = true;
-    QList<QPair<QString, QFileInfo> > updatedFiles;
+    UpdateBatch batch(path);
     QStringList filesToCheck = files;
-
-    QString itPath = QDir::fromNativeSeparators(files.isEmpty() ? path : QLatin1String(""));
-    QDirIterator dirIt(itPath, QDir::AllEntries | QDir::System | QDir::Hidden);
     QStringList allFiles;
-    while (!abort && dirIt.hasNext()) {
-        dirIt.next();
-        fileInfo = dirIt.fileInfo();
-        allFiles.append(fileInfo.fileName());
-    fetch(fileInfo, base, firstTime, updatedFiles, path);
+
+    bool listed = false;
+#ifdef UI_GATHERER_DIRENT
+    if (files.isEmpty())
+        listed = readDirectory(path, allFiles, batch);
+#endif
+    if (!listed) {
+        QString itPath = QDir::fromNativeSeparators(files.isEmpty() ? path : QLatin1String(""));
+        QDirIterator dirIt(itPath, QDir::AllEntries | QDir::System | QDir::Hidden);
+        while (!abort.load() && dirIt.hasNext()) {
+            dirIt.next();
+            fileInfo = dirIt.fileInfo();
+            allFiles.append(fileInfo.fileName());
+            fetch(fileInfo.fileName(), getInfo(fileInfo), batch);
+        }
     }
     if (!allFiles.isEmpty())
         emit newListOfFiles(path, allFiles);
 
     QStringList::const_iterator filesIt = filesToCheck.constBegin();
-    while (!abort && filesIt != filesToCheck.constEnd()) {
+    while (!abort.load() && filesIt != filesToCheck.constEnd()) {
+#ifdef UI_GATHERER_DIRENT
+        const QByteArray nativePath = QFile::encodeName(path + QLatin1Char('/') + *filesIt);
+        fetch(*filesIt, statEntry(AT_FDCWD, nativePath.constData(), DT_UNKNOWN, *filesIt, true), batch);
+#else
         fileInfo.setFile(path + QDir::separator() + *filesIt);
+        fetch(fileInfo.fileName(), getInfo(fileInfo), batch);
+#endif
         ++filesIt;
-        fetch(fileInfo, base, firstTime, updatedFiles, path);
     }
-    if (!updatedFiles.isEmpty())
-        emit updates(path, updatedFiles);
+    if (!batch.files.isEmpty())
+        flush(batch);
     emit directoryLoaded(path);
 }
 
-void UiFileInfoGatherer::fetch(const QFileInfo &fileInfo, QElapsedTimer &base, bool &firstTime, QList<QPair<QString, QFileInfo> > &updatedFiles, const QString &path) {
-    updatedFiles.append(QPair<QString, QFileInfo>(fileInfo.fileName(), fileInfo));
-    QElapsedTimer current;
-    current.start();
-    if ((firstTime && updatedFiles.count() > 100) || base.msecsTo(current) > 1000) {
-        emit updates(path, updatedFiles);
-        updatedFiles.clear();
-        base = current;
-        firstTime = false;
+#ifdef UI_GATHERER_DIRENT
+namespace {
+struct UiStatResult
+{
+    mode_t mode;
+    qint64 size;
+    qint64 lastModified;
+};
+}
+
+// One statx() asking only for what the model shows, or fstatat() where the
+// kernel or the C library lack statx()
+static bool statAt(int dirFd, const char *name, bool follow, UiStatResult *result)
+{
+    const int flags = follow ? 0 : AT_SYMLINK_NOFOLLOW;
+#ifdef STATX_TYPE
+    struct statx stx;
+    if (::statx(dirFd, name, flags, STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME, &stx) == 0) {
+        result->mode = stx.stx_mode;
+        result->size = stx.stx_size;
+        result->lastModified = qint64(stx.stx_mtime.tv_sec) * 1000 + stx.stx_mtime.tv_nsec / 1000000;
+        return true;
     }
+    if (errno != ENOSYS)
+        return false;
+#endif
+    struct stat st;
+    if (::fstatat(dirFd, name, &st, flags) != 0)
+        return false;
+    result->mode = st.st_mode;
+    result->size = st.st_size;
+    result->lastModified = qint64(st.st_mtim.tv_sec) * 1000 + st.st_mtim.tv_nsec / 1000000;
+    return true;
+}
+
+/*
+    Lists \a path with readdir(), which already knows the type of each entry,
+    so that each entry costs one stat relative to the directory, and two for
+    symbolic links whose target decides the type, besides the access checks
+    for the permissions of the user. Returns false if the
+    directory can't be opened, leaving it to QDirIterator.
+*/
+bool UiFileInfoGatherer::readDirectory(const QString &path, QStringList &allFiles, UpdateBatch &batch)
+{
+    DIR *dir = ::opendir(QFile::encodeName(QDir::fromNativeSeparators(path)).constData());
+    if (!dir)
+        return false;
+
+    const int fd = ::dirfd(dir);
+    const bool details = !m_detailsOnDemand.load();
+    while (!abort.load()) {
+        const struct dirent *entry = ::readdir(dir);
+        if (!entry)
+            break;
+        const QString fileName = QFile::decodeName(entry->d_name);
+        allFiles.append(fileName);
+        fetch(fileName, statEntry(fd, entry->d_name, entry->d_type, fileName, details), batch);
+    }
+    ::closedir(dir);
+    return true;
+}
+
+/*
+    The same information getInfo() gets from a QFileInfo, from the d_type of
+    a directory entry and as few stat calls as possible. Permissions for the
+    current user are checked with faccessat() for the effective user.
+
+    Without \a details, entries whose d_type is known are not stat'ed at all.
+*/
+UiExtendedInformation UiFileInfoGatherer::statEntry(int dirFd, const char *name, uchar dType, const QString &fileName, bool details) const
+{
+    UiExtendedInformation info;
+    const int dot = fileName.lastIndexOf(QLatin1Char('.'));
+    const QString suffix = dot == -1 ? QString() : fileName.mid(dot + 1);
+    if (!details && dType != DT_UNKNOWN && dType != DT_LNK) {
+        UiExtendedInformation::Type type = UiExtendedInformation::System;
+        if (dType == DT_DIR)
+            type = UiExtendedInformation::Dir;
+        else if (dType == DT_REG)
+            type = UiExtendedInformation::File;
+        info.setType(type, fileName.startsWith(QLatin1Char('.')), false);
+        info.displayType = _type(false, type == UiExtendedInformation::File,
+                                 type == UiExtendedInformation::Dir, false, suffix);
+        return info;
+    }
+
+    UiStatResult st;
+    bool symLink = dType == DT_LNK;
+    bool exists;
+    if (dType == DT_UNKNOWN) {
+        if (!statAt(dirFd, name, false, &st))
+            return info;
+        symLink = S_ISLNK(st.mode);
+        exists = !symLink || statAt(dirFd, name, true, &st);
+    } else {
+        exists = statAt(dirFd, name, true, &st);
+    }
+    if (!exists && !symLink)
+        return info; // removed meanwhile
+
+    UiExtendedInformation::Type type = UiExtendedInformation::System;
+    if (exists && S_ISDIR(st.mode))
+        type = UiExtendedInformation::Dir;
+    else if (exists && S_ISREG(st.mode))
+        type = UiExtendedInformation::File;
+
+    qint64 size = -1;
+    if (type == UiExtendedInformation::Dir)
+        size = 0;
+    else if (type == UiExtendedInformation::File)
+        size = st.size;
+
+    QFile::Permissions permissions = 0;
+    if (exists) {
+        const mode_t mode = st.mode;
+        if (mode & S_IRUSR) permissions |= QFile::ReadOwner;
+        if (mode & S_IWUSR) permissions |= QFile::WriteOwner;
+        if (mode & S_IXUSR) permissions |= QFile::ExeOwner;
+        if (mode & S_IRGRP) permissions |= QFile::ReadGroup;
+        if (mode & S_IWGRP) permissions |= QFile::WriteGroup;
+        if (mode & S_IXGRP) permissions |= QFile::ExeGroup;
+        if (mode & S_IROTH) permissions |= QFile::ReadOther;
+        if (mode & S_IWOTH) permissions |= QFile::WriteOther;
+        if (mode & S_IXOTH) permissions |= QFile::ExeOther;
+
+        // what the user may do is left to the kernel, which knows about ACLs,
+        // capabilities and read-only mounts
+        if (::faccessat(dirFd, name, R_OK, AT_EACCESS) == 0)
+            permissions |= QFile::ReadUser;
+        if (::faccessat(dirFd, name, W_OK, AT_EACCESS) == 0)
+            permissions |= QFile::WriteUser;
+        if (::faccessat(dirFd, name, X_OK, AT_EACCESS) == 0)
+            permissions |= QFile::ExeUser;
+    }
+
+    info.setStat(type, size, exists ? st.lastModified : UiExtendedInformation::noTime(),
+                 permissions, fileName.startsWith(QLatin1Char('.')), symLink);
+    info.displayType = _type(false, type == UiExtendedInformation::File, type == UiExtendedInformation::Dir,
+                             symLink, suffix);
+    return info;
+}
+#endif // UI_GATHERER_DIRENT
+
+/*
+    Adds \a info to \a batch and reports the batch when it is due: the first
+    one after FirstBatchSize entries or one interval, so that the first rows
+    show up quickly, the others every interval. While the receiver is behind,
+    batches grow instead, up to MaxBatchDelay intervals.
+*/
+void UiFileInfoGatherer::fetch(const QString &fileName, const UiExtendedInformation &info, UpdateBatch &batch)
+{
+    batch.files.append(QPair<QString, UiExtendedInformation>(fileName, info));
+    const int interval = m_updateInterval.load();
+    if (batch.first && batch.files.count() >= FirstBatchSize) {
+        flush(batch);
+        return;
+    }
+    if (!batch.timer.hasExpired(interval))
+        return;
+    if (pendingUpdates.load() > 0 && !batch.timer.hasExpired(qint64(interval) * MaxBatchDelay))
+        return;
+    flush(batch);
+}
+
+void UiFileInfoGatherer::flush(UpdateBatch &batch)
+{
+    // hand the list over, so that the receiver holds the only reference to it
+    QList<QPair<QString, UiExtendedInformation> > files;
+    files.swap(batch.files);
+    pendingUpdates.ref();
+    emit updates(batch.path, files);
+    batch.timer.restart();
+    batch.first = false;
 }
 
 #endif // QT_NO_FILESYSTEMMODEL
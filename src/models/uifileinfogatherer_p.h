@@ -53,36 +53,102 @@
 // We mean it.
 //
 #include "uihelpersglobal.h"
+#include "uiinotifywatcher_p.h"
 #include <qthread.h>
 #include <qmutex.h>
 #include <qwaitcondition.h>
 #include <qfilesystemwatcher.h>
 #include <qpair.h>
-#include <qstack.h>
+#include <qmap.h>
+#include <qhash.h>
+#include <qset.h>
+#include <qvector.h>
 #include <qdatetime.h>
 #include <qdir.h>
 #include <qelapsedtimer.h>
+#include <qatomic.h>
 
 #include <private/qfilesystemengine_p.h>
 #include <qcoreapplication.h>
 
+#include <limits>
+
+#if defined(Q_OS_LINUX)
+#  define UI_GATHERER_DIRENT
+#endif
+
 QT_BEGIN_NAMESPACE_UIHELPERS
 
 class UiExtendedInformation {
 public:
     enum Type { Dir, File, System };
 
-    UiExtendedInformation() {}
-    UiExtendedInformation(const QFileInfo &info) : mFileInfo(info) {}
+    UiExtendedInformation()
+        : mSize(-1), mLastModified(noTime()), mPermissions(0), mType(System),
+          mHidden(false), mSymLink(false), mDetails(true) {}
+
+    UiExtendedInformation(const QFileInfo &info)
+        : mSize(-1), mLastModified(noTime()), mPermissions(0), mType(System),
+          mHidden(info.isHidden()), mSymLink(info.isSymLink()), mDetails(true)
+    {
+        if (info.isDir())
+            mType = Dir;
+        else if (info.isFile())
+            mType = File;
+        if (info.exists() || mSymLink) {
+            if (mType == Dir)
+                mSize = 0;
+            else if (mType == File)
+                mSize = info.size();
+        }
+        mPermissions = info.permissions();
+        const QDateTime modified = info.lastModified();
+        if (modified.isValid())
+            mLastModified = modified.toMSecsSinceEpoch();
+    }
+
+    // Fills in what the model needs at once, e.g. from a single stat() call
+    void setStat(Type type, qint64 size, qint64 lastModified, QFile::Permissions permissions,
+                 bool hidden, bool symLink)
+    {
+        mType = type;
+        mSize = size;
+        mLastModified = lastModified;
+        mPermissions = permissions;
+        mHidden = hidden;
+        mSymLink = symLink;
+        mDetails = true;
+    }
+
+    // Fills in only what a directory entry tells; size, modification time
+    // and permissions are left for a later, detailed fetch
+    void setType(Type type, bool hidden, bool symLink)
+    {
+        mType = type;
+        mSize = type == Dir || type == File ? 0 : -1;
+        mLastModified = noTime();
+        mPermissions = 0;
+        mHidden = hidden;
+        mSymLink = symLink;
+        mDetails = false;
+    }
 
-    inline bool isDir() { return type() == Dir; }
-    inline bool isFile() { return type() == File; }
-    inline bool isSystem() { return type() == System; }
+    // false until size, modification time and permissions are known
+    inline bool hasDetails() const { return mDetails; }
+
+    inline bool isDir() const { return type() == Dir; }
+    inline bool isFile() const { return type() == File; }
+    inline bool isSystem() const { return type() == System; }
 
     bool operator ==(const UiExtendedInformation &fileInfo) const {
-       return mFileInfo == fileInfo.mFileInfo
-       && displayType == fileInfo.displayType
-       && permissions() == fileInfo.permissions();
+       return mType == fileInfo.mType
+       && mSize == fileInfo.mSize
+       && mLastModified == fileInfo.mLastModified
+       && mPermissions == fileInfo.mPermissions
+       && mHidden == fileInfo.mHidden
+       && mSymLink == fileInfo.mSymLink
+       && mDetails == fileInfo.mDetails
+       && displayType == fileInfo.displayType;
     }
 
 #ifndef QT_NO_FSFILEENGINE
@@ -92,66 +158,60 @@ public:
 #endif
 
     QFile::Permissions permissions() const {
-        return mFileInfo.permissions();
+        return mPermissions;
     }
 
     Type type() const {
-        if (mFileInfo.isDir()) {
-            return UiExtendedInformation::Dir;
-        }
-        if (mFileInfo.isFile()) {
-            return UiExtendedInformation::File;
-        }
-        if (!mFileInfo.exists() && mFileInfo.isSymLink()) {
-            return UiExtendedInformation::System;
-        }
-        return UiExtendedInformation::System;
+        return mType;
     }
 
     bool isSymLink() const {
-        return mFileInfo.isSymLink();
+        return mSymLink;
     }
 
     bool isHidden() const {
-        return mFileInfo.isHidden();
-    }
-
-    QFileInfo fileInfo() const {
-        return mFileInfo;
+        return mHidden;
     }
 
     QDateTime lastModified() const {
-        return mFileInfo.lastModified();
+        if (mLastModified == noTime())
+            return QDateTime();
+        return QDateTime::fromMSecsSinceEpoch(mLastModified);
     }
 
+    // 0 for directories, -1 for system files and files that don't exist
     qint64 size() const {
-        qint64 size = -1;
-        if (type() == UiExtendedInformation::Dir)
-            size = 0;
-        if (type() == UiExtendedInformation::File)
-            size = mFileInfo.size();
-        if (!mFileInfo.exists() && !mFileInfo.isSymLink())
-            size = -1;
-        return size;
+        return mSize;
     }
 
+    static inline qint64 noTime() { return std::numeric_limits<qint64>::min(); }
+
     QString displayType;
 
 private :
-    QFileInfo mFileInfo;
+    qint64 mSize;
+    qint64 mLastModified; // msecs since epoch, or noTime()
+    QFile::Permissions mPermissions;
+    Type mType;
+    bool mHidden;
+    bool mSymLink;
+    bool mDetails;
 };
 
 #ifndef QT_NO_FILESYSTEMMODEL
 
+class UiFileInfoGathererWorker;
+
 class Q_AUTOTEST_EXPORT UiFileInfoGatherer : public QThread
 {
 Q_OBJECT
 
 Q_SIGNALS:
-    void updates(const QString &directory, const QList<QPair<QString, QFileInfo> > &updates);
+    void updates(const QString &directory, const QList<QPair<QString, UiExtendedInformation> > &updates);
     void newListOfFiles(const QString &directory, const QStringList &listOfFiles) const;
     void nameResolved(const QString &fileName, const QString &resolvedName) const;
     void directoryLoaded(const QString &path);
+    void filesRemoved(const QString &directory, const QStringList &files);
 
 public:
     UiFileInfoGatherer(QObject *parent = 0);
@@ -167,26 +227,70 @@ public Q_SLOTS:
     void updateFile(const QString &path);
     void setResolveSymlinks(bool enable);
     bool resolveSymlinks() const;
+    void prioritize(const QString &path);
+    void cancel(const QString &path);
+    void setDetailsOnDemand(bool enable);
+    bool detailsOnDemand() const;
+    void setUpdateInterval(int msecs);
+    int updateInterval() const;
+    void updatesHandled();
 
 protected:
     void run();
     void getFileInfos(const QString &path, const QStringList &files);
 
 private:
-    void fetch(const QFileInfo &info, QElapsedTimer &base, bool &firstTime, QList<QPair<QString, QFileInfo> > &updatedFiles, const QString &path);
+    friend class UiFileInfoGathererWorker;
+
+    enum RequestPriority { PrioritizedRequest, FilesRequest, ListingRequest };
+    enum { FirstBatchSize = 100, MaxBatchDelay = 4 };
+    typedef QPair<int, qint64> RequestKey; // priority, then newest first
+    struct Request {
+        QString path;
+        QStringList files;
+    };
+
+    void processQueue();
+    bool takeRequest(QString *path, QStringList *files);
+    int priority(const QString &path, const QStringList &files) const;
+    void dequeue(const RequestKey &key);
+    void requeue(const QString &path);
+    // Collects the updates of one request until they are worth a signal
+    struct UpdateBatch {
+        explicit UpdateBatch(const QString &path) : path(path), first(true) { timer.start(); }
+        QString path;
+        QList<QPair<QString, UiExtendedInformation> > files;
+        QElapsedTimer timer; // since the last signal
+        bool first;
+    };
+
+    void fetch(const QString &fileName, const UiExtendedInformation &info, UpdateBatch &batch);
+    void flush(UpdateBatch &batch);
     QString translateDriveName(const QFileInfo &drive) const;
+#ifndef QT_NO_FILESYSTEMWATCHER
+    void watchDirectory(const QString &path);
+#endif
+#ifdef UI_GATHERER_DIRENT
+    bool readDirectory(const QString &path, QStringList &allFiles, UpdateBatch &batch);
+    UiExtendedInformation statEntry(int dirFd, const char *name, uchar dType, const QString &fileName, bool details) const;
+#endif
 
     QString _type(const QFileInfo &info) const
     {
-        if (info.isRoot())
+        return _type(info.isRoot(), info.isFile(), info.isDir(), info.isSymLink(), info.suffix());
+    }
+
+    QString _type(bool isRoot, bool isFile, bool isDir, bool isSymLink, const QString &suffix) const
+    {
+        if (isRoot)
             return QCoreApplication::translate("QFileDialog", "Drive");
-        if (info.isFile()) {
-            if (!info.suffix().isEmpty())
-                return info.suffix() + QLatin1Char(' ') + QCoreApplication::translate("QFileDialog", "File");
+        if (isFile) {
+            if (!suffix.isEmpty())
+                return suffix + QLatin1Char(' ') + QCoreApplication::translate("QFileDialog", "File");
             return QCoreApplication::translate("QFileDialog", "File");
         }
 
-        if (info.isDir())
+        if (isDir)
     #ifdef Q_OS_WIN
             return QCoreApplication::translate("QFileDialog", "File Folder", "Match Windows Explorer");
     #else
@@ -197,7 +301,7 @@ private:
         // Konqueror - "Folder"
         // Nautilus  - "folder"
 
-        if (info.isSymLink())
+        if (isSymLink)
     #ifdef Q_OS_MAC
             return QCoreApplication::translate("QFileDialog", "Alias", "Mac OS X Finder");
     #else
@@ -213,13 +317,28 @@ private:
 
     QMutex mutex;
     QWaitCondition condition;
-    volatile bool abort;
-
-    QStack<QString> path;
-    QStack<QStringList> files;
+    QAtomicInt abort; // read without the mutex by the readers of directories
+
+    QMap<RequestKey, Request> requests;
+    QMultiHash<QString, RequestKey> queuedPaths;
+    QString priorityPath;
+    qint64 serial;
+    QAtomicInt m_detailsOnDemand;
+    QAtomicInt m_updateInterval;
+    // updates signals the receiver hasn't handled yet
+    QAtomicInt pendingUpdates;
+
+    // the gatherer thread is the first worker, these are the others
+    QList<UiFileInfoGathererWorker *> workers;
+    // directories being read, a directory is read by one worker at a time
+    QSet<QString> busyPaths;
 
 #ifndef QT_NO_FILESYSTEMWATCHER
     QFileSystemWatcher *watcher;
+#endif
+#ifdef UI_INOTIFY_WATCHER
+    // tells which entries changed, so that a change doesn't relist a directory
+    UiInotifyWatcher *inotifyWatcher;
 #endif
     bool m_resolveSymlinks;
 #ifndef Q_OS_WIN
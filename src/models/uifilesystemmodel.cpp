@@ -45,6 +45,12 @@
 #include <qmimedata.h>
 #include <qurl.h>
 #include <qdebug.h>
+#include <qthreadpool.h>
+#include <qsemaphore.h>
+#include <qatomic.h>
+#include <qmutex.h>
+
+#include <string.h>
 
 #ifdef Q_OS_WIN
 #  include <QtCore/QVarLengthArray>
@@ -240,6 +246,8 @@ UiFileSystemModel::UiFileSystemModel(UiFileSystemModelPrivate &dd, QObject *pare
 */
 UiFileSystemModel::~UiFileSystemModel()
 {
+    Q_D(UiFileSystemModel);
+    d->cancelRefilter();
 }
 
 /*!
@@ -257,8 +265,7 @@ QModelIndex UiFileSystemModel::index(int row, int column, const QModelIndex &par
     Q_ASSERT(parentNode);
 
     // now get the internal pointer for the index
-    QString childName = parentNode->visibleChildren[d->translateVisibleLocation(parentNode, row)];
-    const UiFileSystemModelPrivate::QFileSystemNode *indexNode = parentNode->children.value(childName);
+    const UiFileSystemModelPrivate::QFileSystemNode *indexNode = parentNode->visibleChildren.at(d->translateVisibleLocation(parentNode, row));
     Q_ASSERT(indexNode);
 
     return createIndex(row, column, const_cast<UiFileSystemModelPrivate::QFileSystemNode*>(indexNode));
@@ -377,10 +384,10 @@ UiFileSystemModelPrivate::QFileSystemNode *UiFileSystemModelPrivate::node(const
             if (!info.exists())
                 return rootNode;
             UiFileSystemModelPrivate *p = const_cast<UiFileSystemModelPrivate*>(this);
-            p->addNode(rootNode, host,info);
-            p->addVisibleFiles(rootNode, QStringList(host));
+            QFileSystemNode *hostNode = p->addNode(rootNode, host,info);
+            p->addVisibleFiles(rootNode, QVector<QFileSystemNode *>() << hostNode);
         }
-        r = rootNode->visibleLocation(host);
+        r = rootNode->visibleLocation(rootNode->children.value(host));
         r = translateVisibleLocation(rootNode, r);
         index = q->index(r, 0, QModelIndex());
         pathElements.pop_front();
@@ -434,7 +441,7 @@ UiFileSystemModelPrivate::QFileSystemNode *UiFileSystemModelPrivate::node(const
             UiFileSystemModelPrivate *p = const_cast<UiFileSystemModelPrivate*>(this);
             node = p->addNode(parent, element,info);
 #ifndef QT_NO_FILESYSTEMWATCHER
-            node->populate(fileInfoGatherer.getInfo(info));
+            p->populateNode(node, fileInfoGatherer.getInfo(info));
 #endif
         } else {
             node = parent->children.value(element);
@@ -447,9 +454,11 @@ UiFileSystemModelPrivate::QFileSystemNode *UiFileSystemModelPrivate::node(const
                 return const_cast<UiFileSystemModelPrivate::QFileSystemNode*>(&root);
 
             UiFileSystemModelPrivate *p = const_cast<UiFileSystemModelPrivate*>(this);
-            p->addVisibleFiles(parent, QStringList(element));
-            if (!p->bypassFilters.contains(node))
+            p->addVisibleFiles(parent, QVector<QFileSystemNode *>() << node);
+            if (!p->bypassFilters.contains(node)) {
                 p->bypassFilters[node] = 1;
+                ++p->nodesGeneration;
+            }
             QString dir = q->filePath(this->index(parent));
             if (!node->hasInformation() && fetch) {
                 Fetching f;
@@ -475,15 +484,21 @@ void UiFileSystemModel::timerEvent(QTimerEvent *event)
     if (event->timerId() == d->fetchingTimer.timerId()) {
         d->fetchingTimer.stop();
 #ifndef QT_NO_FILESYSTEMWATCHER
+        // one request per directory, each file once
+        QHash<QString, QStringList> files;
+        QSet<const UiFileSystemModelPrivate::QFileSystemNode *> requested;
         for (int i = 0; i < d->toFetch.count(); ++i) {
             const UiFileSystemModelPrivate::QFileSystemNode *node = d->toFetch.at(i).node;
-            if (!node->hasInformation()) {
-                d->fileInfoGatherer.fetchExtendedInformation(d->toFetch.at(i).dir,
-                                                 QStringList(d->toFetch.at(i).file));
+            if (!node->hasDetails() && !requested.contains(node)) {
+                requested.insert(node);
+                files[d->toFetch.at(i).dir].append(d->toFetch.at(i).file);
             } else {
                 // qDebug() << "yah!, you saved a little gerbil soul";
             }
         }
+        QHash<QString, QStringList>::const_iterator it = files.constBegin();
+        for (; it != files.constEnd(); ++it)
+            d->fileInfoGatherer.fetchExtendedInformation(it.key(), it.value());
 #endif
         d->toFetch.clear();
     }
@@ -556,7 +571,7 @@ QModelIndex UiFileSystemModel::parent(const QModelIndex &index) const
     // get the parent's row
     UiFileSystemModelPrivate::QFileSystemNode *grandParentNode = parentNode->parent;
     Q_ASSERT(grandParentNode->children.contains(parentNode->fileName));
-    int visualRow = d->translateVisibleLocation(grandParentNode, grandParentNode->visibleLocation(grandParentNode->children.value(parentNode->fileName)->fileName));
+    int visualRow = d->translateVisibleLocation(grandParentNode, grandParentNode->visibleLocation(parentNode));
     if (visualRow == -1)
         return QModelIndex();
     return createIndex(visualRow, 0, parentNode);
@@ -579,7 +594,7 @@ QModelIndex UiFileSystemModelPrivate::index(const UiFileSystemModelPrivate::QFil
     if (!node->isVisible)
         return QModelIndex();
 
-    int visualRow = translateVisibleLocation(parentNode, parentNode->visibleLocation(node->fileName));
+    int visualRow = translateVisibleLocation(parentNode, parentNode->visibleLocation(node));
     return q->createIndex(visualRow, 0, const_cast<QFileSystemNode*>(node));
 }
 
@@ -678,9 +693,9 @@ QVariant UiFileSystemModel::data(const QModelIndex &index, int role) const
     case Qt::DisplayRole:
         switch (index.column()) {
         case 0: return d->displayName(index);
-        case 1: return d->size(index);
+        case 1: d->requestDetails(d->node(index)); return d->size(index);
         case 2: return d->type(index);
-        case 3: return d->time(index);
+        case 3: d->requestDetails(d->node(index)); return d->time(index);
         default:
             qWarning("data: invalid display value column %d", index.column());
             break;
@@ -695,6 +710,7 @@ QVariant UiFileSystemModel::data(const QModelIndex &index, int role) const
             return Qt::AlignRight;
         break;
     case FilePermissions:
+        d->requestDetails(d->node(index));
         int p = permissions(index);
         return p;
     }
@@ -836,21 +852,17 @@ bool UiFileSystemModel::setData(const QModelIndex &idx, const QVariant &value, i
 
         UiFileSystemModelPrivate::QFileSystemNode *indexNode = d->node(idx);
         UiFileSystemModelPrivate::QFileSystemNode *parentNode = indexNode->parent;
-        int visibleLocation = parentNode->visibleLocation(parentNode->children.value(indexNode->fileName)->fileName);
-
-        d->addNode(parentNode, newName,indexNode->info->fileInfo());
-        parentNode->visibleChildren.removeAt(visibleLocation);
-        UiFileSystemModelPrivate::QFileSystemNode * oldValue = parentNode->children.value(oldName);
-        parentNode->children[newName] = oldValue;
-        QFileInfo info(d->rootDir, newName);
-        oldValue->fileName = newName;
-        oldValue->parent = parentNode;
-        oldValue->populate(d->fileInfoGatherer.getInfo(info));
-        oldValue->isVisible = true;
 
+        // the node keeps its place among the visible children, only its name changes
         parentNode->children.remove(oldName);
-        parentNode->visibleChildren.insert(visibleLocation, newName);
+        QFileInfo info(d->rootDir, newName);
+        indexNode->setFileName(newName);
+        d->populateNode(indexNode, d->fileInfoGatherer.getInfo(info));
+        indexNode->isVisible = true;
+        parentNode->children.insert(newName, indexNode);
 
+        // the row is now out of order, and new rows are only merged into sorted ones
+        d->forceSort = true;
         d->delayedSort();
         emit fileRenamed(filePath(idx.parent()), oldName, newName);
     }
@@ -912,9 +924,17 @@ Qt::ItemFlags UiFileSystemModel::flags(const QModelIndex &index) const
     }
 
     flags |= Qt::ItemIsDragEnabled;
-    if (d->readOnly)
+    if (d->readOnly || index.column() != 0)
         return flags;
-    if ((index.column() == 0) && indexNode->permissions() & QFile::WriteUser) {
+
+    // Until the details of a node listed without them come, its permissions
+    // aren't known; offer editing anyway and let a rename fail if it must
+    bool writable = indexNode->permissions() & QFile::WriteUser;
+    if (indexNode->hasInformation() && !indexNode->hasDetails()) {
+        d->requestDetails(indexNode);
+        writable = true;
+    }
+    if (writable) {
         flags |= Qt::ItemIsEditable;
         if (indexNode->isDir())
             flags |= Qt::ItemIsDropEnabled;
@@ -924,92 +944,291 @@ Qt::ItemFlags UiFileSystemModel::flags(const QModelIndex &index) const
 
 /*!
     \internal
+
+    Queues a fetch of the size, modification time and permissions of \a node
+    if its listing left them out, unless one is already on its way.
 */
-void UiFileSystemModelPrivate::_q_performDelayedSort()
+void UiFileSystemModelPrivate::requestDetails(const QFileSystemNode *node) const
 {
+    Q_Q(const UiFileSystemModel);
+    if (!node->hasInformation() || node->hasDetails() || !node->parent
+        || (node->attributes & DetailsRequestedAttribute))
+        return;
+    UiFileSystemModelPrivate *p = const_cast<UiFileSystemModelPrivate*>(this);
+    const_cast<QFileSystemNode *>(node)->attributes |= DetailsRequestedAttribute;
+    Fetching f;
+    f.dir = q->filePath(index(node->parent));
+    f.file = node->fileName;
+    f.node = node;
+    p->toFetch.append(f);
+    p->fetchingTimer.start(0, const_cast<UiFileSystemModel*>(q));
+}
+
+/*!
+    \internal
+*/
+void UiFileSystemModelPrivate::requestChildDetails(QFileSystemNode *parentNode, const QModelIndex &parent)
+{
+#ifndef QT_NO_FILESYSTEMWATCHER
     Q_Q(UiFileSystemModel);
-    q->sort(sortColumn, sortOrder);
+    QStringList files;
+    QHash<QString, QFileSystemNode *>::const_iterator it = parentNode->children.constBegin();
+    for (; it != parentNode->children.constEnd(); ++it) {
+        QFileSystemNode *child = it.value();
+        if (child->hasInformation() && !child->hasDetails()
+            && !(child->attributes & DetailsRequestedAttribute)) {
+            child->attributes |= DetailsRequestedAttribute;
+            files.append(it.key());
+        }
+    }
+    if (!files.isEmpty())
+        fileInfoGatherer.fetchExtendedInformation(q->filePath(parent), files);
+#else
+    Q_UNUSED(parentNode);
+    Q_UNUSED(parent);
+#endif
 }
 
-static inline QChar getNextChar(const QString &s, int location)
+/*!
+    \internal
+*/
+void UiFileSystemModelPrivate::updateDetailsPolicy()
 {
-    return (location < s.length()) ? s.at(location) : QChar();
+#ifndef QT_NO_FILESYSTEMWATCHER
+    const bool permissionFilters = filters & QDir::PermissionMask;
+    fileInfoGatherer.setDetailsOnDemand(detailsOnDemand && !permissionFilters);
+    // the nodes listed so far would all fail the permission filters
+    if (detailsOnDemand && permissionFilters)
+        requestTreeDetails(&root);
+#endif
 }
 
 /*!
-    Natural number sort, skips spaces.
+    \internal
+
+    Requests the details left out of the nodes anywhere below \a parentNode.
+*/
+void UiFileSystemModelPrivate::requestTreeDetails(QFileSystemNode *parentNode)
+{
+    if (parentNode->children.isEmpty())
+        return;
+    requestChildDetails(parentNode, index(parentNode));
+    QHash<QString, QFileSystemNode *>::const_iterator it = parentNode->children.constBegin();
+    for (; it != parentNode->children.constEnd(); ++it)
+        requestTreeDetails(it.value());
+}
+
+/*!
+    \internal
+*/
+void UiFileSystemModelPrivate::_q_performDelayedSort()
+{
+    Q_Q(UiFileSystemModel);
+    q->sort(sortColumn, sortOrder);
+}
+
+/*!
+    \internal
+
+    Natural number sort, skips spaces: compares the natural sort keys of
+    \a s1 and \a s2, and only if they are equal, e.g. for "02" and "2",
+    the names themselves, in which case \a cs applies.
 
     Examples:
     1, 2, 10, 55, 100
     01.jpg, 2.jpg, 10.jpg
 
-    Note on the algorithm:
-    Only as many characters as necessary are looked at and at most they all
-    are looked at once.
-
-    Slower then QString::compare() (of course)
+    \sa naturalSortKey()
   */
 int UiFileSystemModelPrivate::naturalCompare(const QString &s1, const QString &s2,  Qt::CaseSensitivity cs)
 {
-    for (int l1 = 0, l2 = 0; l1 <= s1.count() && l2 <= s2.count(); ++l1, ++l2) {
-        // skip spaces, tabs and 0's
-        QChar c1 = getNextChar(s1, l1);
-        while (c1.isSpace())
-            c1 = getNextChar(s1, ++l1);
-        QChar c2 = getNextChar(s2, l2);
-        while (c2.isSpace())
-            c2 = getNextChar(s2, ++l2);
-
-        if (c1.isDigit() && c2.isDigit()) {
-            while (c1.digitValue() == 0)
-                c1 = getNextChar(s1, ++l1);
-            while (c2.digitValue() == 0)
-                c2 = getNextChar(s2, ++l2);
-
-            int lookAheadLocation1 = l1;
-            int lookAheadLocation2 = l2;
-            int currentReturnValue = 0;
-            // find the last digit, setting currentReturnValue as we go if it isn't equal
-            for (
-                QChar lookAhead1 = c1, lookAhead2 = c2;
-                (lookAheadLocation1 <= s1.length() && lookAheadLocation2 <= s2.length());
-                lookAhead1 = getNextChar(s1, ++lookAheadLocation1),
-                lookAhead2 = getNextChar(s2, ++lookAheadLocation2)
-                ) {
-                bool is1ADigit = !lookAhead1.isNull() && lookAhead1.isDigit();
-                bool is2ADigit = !lookAhead2.isNull() && lookAhead2.isDigit();
-                if (!is1ADigit && !is2ADigit)
-                    break;
-                if (!is1ADigit)
-                    return -1;
-                if (!is2ADigit)
-                    return 1;
-                if (currentReturnValue == 0) {
-                    if (lookAhead1 < lookAhead2) {
-                        currentReturnValue = -1;
-                    } else if (lookAhead1 > lookAhead2) {
-                        currentReturnValue = 1;
-                    }
-                }
-            }
-            if (currentReturnValue != 0)
-                return currentReturnValue;
+    const UiNaturalSortTable *table = naturalSortTable();
+    const int r = compareNaturalSortKeys(naturalSortKey(s1, table), naturalSortKey(s2, table), table);
+    if (r != 0)
+        return r;
+    const int c = QString::compare(s1, s2, cs);
+    return c < 0 ? -1 : (c > 0 ? 1 : 0);
+}
+
+namespace {
+enum NaturalKeyMark { DigitsMark = 0x01, FirstRankMark = 0x10, NonAsciiMark = 0xf0 };
+}
+
+/*
+    The order of the ASCII characters in one locale, ignoring case, so
+    that natural sort keys compare them without calling into the locale
+*/
+struct UiNaturalSortTable
+{
+    UiNaturalSortTable()
+    {
+        QList<QChar> chars;
+        for (int c = 0; c < 128; ++c) {
+            const QChar ch(c);
+            if (!ch.isDigit() && !ch.isSpace() && !ch.isUpper())
+                chars.append(ch);
+        }
+        qStableSort(chars.begin(), chars.end(), localeLessThan);
+        int rank = -1;
+        for (int i = 0; i < chars.count(); ++i) {
+            if (i == 0 || QString::localeAwareCompare(QString(chars.at(i - 1)), QString(chars.at(i))) != 0)
+                charOfRank[++rank] = chars.at(i);
+            ranks[chars.at(i).unicode()] = FirstRankMark + rank;
+        }
+        for (int c = 'A'; c <= 'Z'; ++c)
+            ranks[c] = ranks[c - 'A' + 'a'];
+    }
+
+    static bool localeLessThan(const QChar &c1, const QChar &c2)
+    {
+        return QString::localeAwareCompare(QString(c1), QString(c2)) < 0;
+    }
+
+    uchar ranks[128];
+    QChar charOfRank[128];
+};
+
+typedef QHash<QString, QSharedPointer<UiNaturalSortTable> > UiNaturalSortTables;
+Q_GLOBAL_STATIC(UiNaturalSortTables, naturalSortTables)
+Q_GLOBAL_STATIC(QMutex, naturalSortTablesMutex)
+
+/*!
+    \internal
+
+    Returns the collation table for the default locale, building it the
+    first time that locale is used. Tables are kept until exit, so a sort
+    that started before QLocale::setDefault() keeps comparing its keys
+    with the table it made them with; sorts may run on other threads.
+*/
+const UiNaturalSortTable *UiFileSystemModelPrivate::naturalSortTable()
+{
+    const QString locale = QLocale().name();
+    QMutexLocker locker(naturalSortTablesMutex());
+    QSharedPointer<UiNaturalSortTable> &table = (*naturalSortTables())[locale];
+    if (!table)
+        table = QSharedPointer<UiNaturalSortTable>(new UiNaturalSortTable);
+    return table.data();
+}
+
+/*!
+    \internal
+
+    Returns a key for \a name that compareNaturalSortKeys() orders in the
+    natural order, ignoring case: spaces are left out, each run of digits
+    becomes its number of significant digits followed by them, and ASCII
+    characters become their rank in the locale. Other characters are kept
+    as they are and still compared by the locale.
+
+    Numbers sort before any other character, e.g. "a1" before "a-1".
+    The ranks come from \a table, or from the one of the default locale
+    if it is 0; keys only compare with keys made from the same table.
+*/
+QByteArray UiFileSystemModelPrivate::naturalSortKey(const QString &name, const UiNaturalSortTable *table)
+{
+    if (!table)
+        table = naturalSortTable();
+    QByteArray key;
+    key.reserve(name.length() + 2);
+    const int length = name.length();
+    for (int i = 0; i < length; ) {
+        const QChar c = name.at(i);
+        if (c.isSpace()) {
+            ++i;
+        } else if (c.isDigit()) {
+            while (i < length && name.at(i).digitValue() == 0)
+                ++i;
+            int end = i;
+            while (end < length && name.at(end).isDigit())
+                ++end;
+            // absurdly long numbers are cut short, their names still compare
+            const int digits = qMin(end - i, int(NonAsciiMark) - 1);
+            key.append(char(DigitsMark));
+            key.append(char(digits));
+            for (int j = 0; j < digits; ++j)
+                key.append(char('0' + name.at(i + j).digitValue()));
+            i = end;
+        } else if (c.unicode() < 128) {
+            key.append(char(table->ranks[c.unicode()]));
+            ++i;
+        } else {
+            const ushort lower = c.toLower().unicode();
+            key.append(char(NonAsciiMark));
+            key.append(char(lower >> 8));
+            key.append(char(lower & 0xff));
+            ++i;
         }
+    }
+    return key;
+}
 
-        if (cs == Qt::CaseInsensitive) {
-            if (!c1.isLower()) c1 = c1.toLower();
-            if (!c2.isLower()) c2 = c2.toLower();
+static inline QChar naturalKeyChar(const uchar *p, const UiNaturalSortTable *table)
+{
+    if (*p == NonAsciiMark)
+        return QChar(ushort((p[1] << 8) | p[2]));
+    return table->charOfRank[*p - FirstRankMark];
+}
+
+/*!
+    \internal
+
+    Compares keys made by naturalSortKey() from \a table, returning -1, 0
+    or 1. Only characters outside of ASCII are left to the locale.
+*/
+int UiFileSystemModelPrivate::compareNaturalSortKeys(const QByteArray &key1, const QByteArray &key2,
+                                                     const UiNaturalSortTable *table)
+{
+    const uchar *p1 = reinterpret_cast<const uchar *>(key1.constData());
+    const uchar *p2 = reinterpret_cast<const uchar *>(key2.constData());
+    const uchar *end1 = p1 + key1.size();
+    const uchar *end2 = p2 + key2.size();
+    while (p1 != end1 && p2 != end2) {
+        if (*p1 == DigitsMark && *p2 == DigitsMark) {
+            // same number of digits, the digits themselves compare as bytes
+            if (p1[1] != p2[1])
+                return p1[1] < p2[1] ? -1 : 1;
+            const int digits = p1[1] + 2;
+            const int r = memcmp(p1, p2, digits);
+            if (r != 0)
+                return r < 0 ? -1 : 1;
+            p1 += digits;
+            p2 += digits;
+        } else if (*p1 == DigitsMark || *p2 == DigitsMark) {
+            return *p1 == DigitsMark ? -1 : 1;
+        } else if (*p1 == NonAsciiMark || *p2 == NonAsciiMark) {
+            if (!table)
+                table = naturalSortTable();
+            const QChar c1 = naturalKeyChar(p1, table);
+            const QChar c2 = naturalKeyChar(p2, table);
+            if (c1 != c2) {
+                const int r = QString::localeAwareCompare(QString(c1), QString(c2));
+                if (r != 0)
+                    return r < 0 ? -1 : 1;
+            }
+            p1 += *p1 == NonAsciiMark ? 3 : 1;
+            p2 += *p2 == NonAsciiMark ? 3 : 1;
+        } else {
+            if (*p1 != *p2)
+                return *p1 < *p2 ? -1 : 1;
+            ++p1;
+            ++p2;
         }
-        int r = QString::localeAwareCompare(c1, c2);
-        if (r < 0)
-            return -1;
-        if (r > 0)
-            return 1;
     }
-    // The two strings are the same (02 == 2) so fall back to the normal sort
-    return QString::compare(s1, s2, cs);
+    if (p1 == end1)
+        return p2 == end2 ? 0 : -1;
+    return 1;
 }
 
+/*
+    \internal
+    A node with its natural sort key, made for one sort only, so that the
+    nodes don't keep one each
+*/
+struct UiSortItem
+{
+    UiFileSystemModelPrivate::QFileSystemNode *node;
+    QByteArray key;
+};
+
 /*
     \internal
     Helper functor used by sort()
@@ -1017,10 +1236,24 @@ int UiFileSystemModelPrivate::naturalCompare(const QString &s1, const QString &s
 class UiFileSystemModelSorter
 {
 public:
-    inline UiFileSystemModelSorter(int column) : sortColumn(column) {}
+    inline UiFileSystemModelSorter(int column)
+        : sortColumn(column),
+          table(column == 0 ? UiFileSystemModelPrivate::naturalSortTable() : 0) {}
+
+    // only sorting by name needs one
+    inline QByteArray sortKey(const UiFileSystemModelPrivate::QFileSystemNode *node) const
+    {
+        return sortColumn == 0 ? UiFileSystemModelPrivate::naturalSortKey(node->fileName, table) : QByteArray();
+    }
 
     bool compareNodes(const UiFileSystemModelPrivate::QFileSystemNode *l,
                     const UiFileSystemModelPrivate::QFileSystemNode *r) const
+    {
+        return compareNodes(l, sortKey(l), r, sortKey(r));
+    }
+
+    bool compareNodes(const UiFileSystemModelPrivate::QFileSystemNode *l, const QByteArray &lKey,
+                      const UiFileSystemModelPrivate::QFileSystemNode *r, const QByteArray &rKey) const
     {
         switch (sortColumn) {
         case 0: {
@@ -1031,8 +1264,10 @@ public:
             if (left ^ right)
                 return left;
 #endif
-            return UiFileSystemModelPrivate::naturalCompare(l->fileName,
-                                                r->fileName, Qt::CaseInsensitive) < 0;
+            const int c = UiFileSystemModelPrivate::compareNaturalSortKeys(lKey, rKey, table);
+            if (c != 0)
+                return c < 0;
+            return QString::compare(l->fileName, r->fileName, Qt::CaseInsensitive) < 0;
                 }
         case 1:
             // Directories go first
@@ -1054,53 +1289,200 @@ public:
         return compareNodes(l.first, r.first);
     }
 
+    bool operator()(const UiFileSystemModelPrivate::QFileSystemNode *l,
+                    const UiFileSystemModelPrivate::QFileSystemNode *r) const
+    {
+        return compareNodes(l, r);
+    }
+
+    bool operator()(const UiSortItem &l, const UiSortItem &r) const
+    {
+        return compareNodes(l.node, l.key, r.node, r.key);
+    }
+
+    bool operator()(const UiSortItem &l, const UiFileSystemModelPrivate::QFileSystemNode *r) const
+    {
+        return compareNodes(l.node, l.key, r, sortKey(r));
+    }
+
 
 private:
     int sortColumn;
+    // the collation table of the default locale when the sort started
+    const UiNaturalSortTable *table;
+};
+
+typedef QVector<UiFileSystemModelPrivate::QFileSystemNode *>::const_iterator UiNodeIterator;
+
+// Sorts nodes, making the sort key of each once, for this sort only
+static void sortNodes(QVector<UiFileSystemModelPrivate::QFileSystemNode *> *nodes, const UiFileSystemModelSorter &ms)
+{
+    QVector<UiSortItem> items(nodes->count());
+    for (int i = 0; i < items.count(); ++i) {
+        items[i].node = nodes->at(i);
+        items[i].key = ms.sortKey(nodes->at(i));
+    }
+    qStableSort(items.begin(), items.end(), ms);
+    for (int i = 0; i < items.count(); ++i)
+        (*nodes)[i] = items.at(i).node;
+}
+
+// Merges two sorted runs of nodes, those of the left one first among equals
+static QVector<UiFileSystemModelPrivate::QFileSystemNode *> mergeSorted(UiNodeIterator left, UiNodeIterator leftEnd,
+                                                                        UiNodeIterator right, UiNodeIterator rightEnd,
+                                                                        const UiFileSystemModelSorter &ms)
+{
+    QVector<UiFileSystemModelPrivate::QFileSystemNode *> merged;
+    merged.reserve((leftEnd - left) + (rightEnd - right));
+    // the keys of the two nodes being compared, each made once
+    QByteArray leftKey = left != leftEnd ? ms.sortKey(*left) : QByteArray();
+    QByteArray rightKey = right != rightEnd ? ms.sortKey(*right) : QByteArray();
+    while (left != leftEnd && right != rightEnd) {
+        if (ms.compareNodes(*right, rightKey, *left, leftKey)) {
+            merged.append(*right++);
+            if (right != rightEnd)
+                rightKey = ms.sortKey(*right);
+        } else {
+            merged.append(*left++);
+            if (left != leftEnd)
+                leftKey = ms.sortKey(*left);
+        }
+    }
+    while (left != leftEnd)
+        merged.append(*left++);
+    while (right != rightEnd)
+        merged.append(*right++);
+    return merged;
+}
+
+// Below this many children in all, sorting on other threads doesn't pay off
+static const int minParallelSortSize = 4096;
+
+static void sortJobs(UiFileSystemModelPrivate::SortJob **jobs, int count, int column, QAtomicInt *next)
+{
+    UiFileSystemModelSorter ms(column);
+    for (int i = next->fetchAndAddRelaxed(1); i < count; i = next->fetchAndAddRelaxed(1))
+        sortNodes(&jobs[i]->children, ms);
+}
+
+/*
+    \internal
+    Sorts directories for sortChildren() on a thread of the global pool
+*/
+class UiFileSystemModelSortTask : public QRunnable
+{
+public:
+    UiFileSystemModelSortTask(UiFileSystemModelPrivate::SortJob **jobs, int count, int column,
+                              QAtomicInt *next, QSemaphore *done)
+        : jobs(jobs), count(count), column(column), next(next), done(done) {}
+
+    void run()
+    {
+        sortJobs(jobs, count, column, next);
+        done->release();
+    }
+
+private:
+    UiFileSystemModelPrivate::SortJob **jobs;
+    int count;
+    int column;
+    QAtomicInt *next;
+    QSemaphore *done;
 };
 
+static bool moreSortWork(const UiFileSystemModelPrivate::SortJob *j1, const UiFileSystemModelPrivate::SortJob *j2)
+{
+    return j1->children.count() > j2->children.count();
+}
+
 /*
     \internal
 
-    Sort all of the children of parent
+    Sort all of the children of parent, and of its visible descendants unless
+    disableRecursiveSort is set. The directories are independent, so while
+    the GUI thread sorts them, so do idle threads of the global thread pool;
+    the nodes are only changed once all are sorted, on the GUI thread.
 */
 void UiFileSystemModelPrivate::sortChildren(int column, const QModelIndex &parent)
 {
-    Q_Q(UiFileSystemModel);
-    UiFileSystemModelPrivate::QFileSystemNode *indexNode = node(parent);
-    if (indexNode->children.count() == 0)
+    QVector<SortJob> jobs;
+    collectSortJobs(node(parent), &jobs);
+    if (jobs.isEmpty())
         return;
 
-    QList<QPair<UiFileSystemModelPrivate::QFileSystemNode*, int> > values;
-    QHash<QString, QFileSystemNode *>::const_iterator iterator;
-    int i = 0;
-    for (iterator = indexNode->children.begin() ; iterator != indexNode->children.end() ; ++iterator) {
-        if (filtersAcceptsNode(iterator.value())) {
-            values.append(QPair<UiFileSystemModelPrivate::QFileSystemNode*, int>((iterator.value()), i));
-        } else {
-            iterator.value()->isVisible = false;
+    // the biggest directories first, so that no thread is left with one at the end
+    QVector<SortJob *> work;
+    work.reserve(jobs.count());
+    int size = 0;
+    for (int i = 0; i < jobs.count(); ++i) {
+        work.append(&jobs[i]);
+        size += jobs.at(i).children.count();
+    }
+    qSort(work.begin(), work.end(), moreSortWork);
+
+    QAtomicInt next(0);
+    QSemaphore done;
+    int helpers = 0;
+    if (size >= minParallelSortSize) {
+        QThreadPool *pool = QThreadPool::globalInstance();
+        const int wanted = qMin(work.count(), pool->maxThreadCount()) - 1;
+        for (int i = 0; i < wanted; ++i) {
+            // only threads that are free now, waiting for busy ones would stall the GUI
+            if (!pool->tryStart(new UiFileSystemModelSortTask(work.data(), work.count(), column, &next, &done)))
+                break;
+            ++helpers;
         }
-        i++;
     }
-    UiFileSystemModelSorter ms(column);
-    qStableSort(values.begin(), values.end(), ms);
-    // First update the new visible list
-    indexNode->visibleChildren.clear();
-    //No more dirty item we reset our internal dirty index
-    indexNode->dirtyChildrenIndex = -1;
-    for (int i = 0; i < values.count(); ++i) {
-        indexNode->visibleChildren.append(values.at(i).first->fileName);
-        values.at(i).first->isVisible = true;
+    sortJobs(work.data(), work.count(), column, &next);
+    done.acquire(helpers);
+
+    // parents come before their children, so the indexes of the latter are valid
+    for (int i = 0; i < jobs.count(); ++i) {
+        QFileSystemNode *indexNode = jobs.at(i).node;
+        const QVector<QFileSystemNode *> &children = jobs.at(i).children;
+        for (int j = 0; j < indexNode->visibleChildren.count(); ++j) {
+            indexNode->visibleChildren.at(j)->isVisible = false;
+            indexNode->visibleChildren.at(j)->visibleIndex = -1;
+        }
+        indexNode->visibleChildren = children;
+        //No more dirty item we reset our internal dirty index
+        indexNode->dirtyChildrenIndex = -1;
+        for (int j = 0; j < children.count(); ++j) {
+            children.at(j)->isVisible = true;
+            children.at(j)->visibleIndex = j;
+        }
+
+        // sorting by size or date needs them for every child, not only visible ones
+        if (column == 1 || column == 3)
+            requestChildDetails(indexNode, index(indexNode));
+    }
+}
+
+/*
+    \internal
+
+    Adds the children of \a indexNode the filters accept to \a jobs, then
+    those of each of them, in that order.
+*/
+void UiFileSystemModelPrivate::collectSortJobs(QFileSystemNode *indexNode, QVector<SortJob> *jobs)
+{
+    if (indexNode->children.count() == 0)
+        return;
+
+    SortJob job;
+    job.node = indexNode;
+    job.children.reserve(indexNode->children.count());
+    QHash<QString, QFileSystemNode *>::const_iterator iterator;
+    for (iterator = indexNode->children.constBegin() ; iterator != indexNode->children.constEnd() ; ++iterator) {
+        if (filtersAcceptsNode(iterator.value()))
+            job.children.append(iterator.value());
     }
+    jobs->append(job);
 
     if (!disableRecursiveSort) {
-        for (int i = 0; i < q->rowCount(parent); ++i) {
-            const QModelIndex childIndex = q->index(i, 0, parent);
-            UiFileSystemModelPrivate::QFileSystemNode *indexNode = node(childIndex);
-            //Only do a recursive sort on visible nodes
-            if (indexNode->isVisible)
-                sortChildren(column, childIndex);
-        }
+        //Only do a recursive sort on visible nodes
+        for (int i = 0; i < job.children.count(); ++i)
+            collectSortJobs(job.children.at(i), jobs);
     }
 }
 
@@ -1126,6 +1508,8 @@ void UiFileSystemModel::sort(int column, Qt::SortOrder order)
         d->sortChildren(column, index(rootPath()));
         d->sortColumn = column;
         d->forceSort = false;
+        // that applied the filters too
+        d->cancelRefilter();
     }
     d->sortOrder = order;
 
@@ -1139,6 +1523,350 @@ void UiFileSystemModel::sort(int column, Qt::SortOrder order)
     emit layoutChanged();
 }
 
+/*
+    \internal
+    What filtersAcceptsNode() looks at of a child, copied by refilter()
+*/
+struct UiRefilterEntry
+{
+    // only compared and handed back, never dereferenced off the GUI thread
+    UiFileSystemModelPrivate::QFileSystemNode *node;
+    // shared with the node, and only when name filters look at it
+    QString fileName;
+    ushort attributes;
+    bool hasInformation;
+    bool isDir;
+    bool bypass;
+    // where its own children are in UiFileSystemRefilter::directories, or -1
+    int directory;
+};
+
+struct UiRefilterDirectory
+{
+    UiFileSystemModelPrivate::QFileSystemNode *node;
+    int first;
+    int count;
+};
+
+/*
+    \internal
+
+    A snapshot of the nodes below the root path and of the filters, taken on
+    the GUI thread by refilter(). run() works out from it alone which children
+    of each directory the filters accept, so that the GUI thread can go on
+    changing the nodes meanwhile.
+*/
+class UiFileSystemRefilter
+{
+public:
+    UiFileSystemRefilter() : receiver(0), finished(false) {}
+
+    void run()
+    {
+        accepted.resize(directories.count());
+        filtered.fill(false, directories.count());
+        filterDirectory(0);
+
+        QMutexLocker locker(&mutex);
+        finished = true;
+        if (receiver)
+            QMetaObject::invokeMethod(receiver, "_q_refiltered", Qt::QueuedConnection);
+    }
+
+    void cancel()
+    {
+        QMutexLocker locker(&mutex);
+        receiver = 0;
+    }
+
+    bool isFinished()
+    {
+        QMutexLocker locker(&mutex);
+        return finished;
+    }
+
+    // the directories, each before its subdirectories, and all of their children
+    QVector<UiRefilterDirectory> directories;
+    QVector<UiRefilterEntry> entries;
+    int nodesGeneration;
+    ushort hiddenAttributes;
+    bool nameFilterDisables;
+    bool allDirs;
+    bool matchesNames;
+#ifndef QT_NO_REGEXP
+    UiNameFilterMatcher nameFilters;
+#endif
+    QObject *receiver;
+
+    // the children each directory shows, for those whose parent does
+    QVector<QVector<UiFileSystemModelPrivate::QFileSystemNode *> > accepted;
+    QVector<bool> filtered;
+
+private:
+    // as filtersAcceptsNode() and passNameFilters()
+    bool accepts(const UiRefilterEntry &entry) const
+    {
+        if (entry.bypass)
+            return true;
+        if (!entry.hasInformation)
+            return false;
+        if (entry.attributes & hiddenAttributes)
+            return false;
+#ifndef QT_NO_REGEXP
+        if (matchesNames && !(entry.isDir && allDirs))
+            return nameFilters.matches(entry.fileName);
+#endif
+        return true;
+    }
+
+    void filterDirectory(int index)
+    {
+        filtered[index] = true;
+        const UiRefilterDirectory &directory = directories.at(index);
+        for (int i = directory.first; i < directory.first + directory.count; ++i) {
+            const UiRefilterEntry &entry = entries.at(i);
+            if (!accepts(entry))
+                continue;
+            accepted[index].append(entry.node);
+            // as sortChildren(), only descend into the directories that are shown
+            if (entry.directory != -1)
+                filterDirectory(entry.directory);
+        }
+    }
+
+    QMutex mutex;
+    bool finished;
+};
+
+/*
+    \internal
+    Runs a UiFileSystemRefilter on a thread of the global pool, which may
+    outlive the model
+*/
+class UiFileSystemRefilterTask : public QRunnable
+{
+public:
+    UiFileSystemRefilterTask(const QSharedPointer<UiFileSystemRefilter> &job) : job(job) {}
+
+    void run() { job->run(); }
+
+private:
+    QSharedPointer<UiFileSystemRefilter> job;
+};
+
+// Below this many children in all, filtering and sorting them on the GUI
+// thread is quicker than the snapshot plus the thread hand-over both ways
+static const int minBackgroundRefilterSize = 4096;
+
+/*!
+    \internal
+
+    Shows the nodes the filters accept after they changed. sortChildren()
+    would filter every child of every directory on the GUI thread, so a large
+    tree that is already sorted is filtered on a thread of the global pool
+    instead, from a snapshot of its nodes, and _q_refiltered() applies the
+    result in one layout change. Anything else is left to a delayed sort.
+
+    The children are counted before anything is copied, so that a small tree
+    costs no snapshot at all.
+*/
+void UiFileSystemModelPrivate::refilter()
+{
+    Q_Q(UiFileSystemModel);
+    cancelRefilter();
+    if (forceSort) {
+        // a full sort is due anyway
+        delayedSort();
+        return;
+    }
+
+    QFileSystemNode *rootNode = node(q->index(q->rootPath()));
+    const int count = countChildren(rootNode);
+    if (count < minBackgroundRefilterSize) {
+        forceSort = true;
+        delayedSort();
+        return;
+    }
+
+    QSharedPointer<UiFileSystemRefilter> job(new UiFileSystemRefilter);
+    job->nodesGeneration = nodesGeneration;
+    job->hiddenAttributes = hiddenAttributes;
+    job->nameFilterDisables = nameFilterDisables;
+    job->allDirs = filters & QDir::AllDirs;
+#ifndef QT_NO_REGEXP
+    job->nameFilters = nameFilters;
+    job->matchesNames = !nameFilterDisables && !nameFilters.isEmpty();
+#else
+    job->matchesNames = false;
+#endif
+    job->entries.reserve(count);
+    snapshotChildren(rootNode, job.data());
+    job->receiver = q;
+    refilterJob = job;
+    QThreadPool::globalInstance()->start(new UiFileSystemRefilterTask(job));
+}
+
+/*!
+    \internal
+
+    Returns how many children snapshotChildren() would copy for \a indexNode.
+*/
+int UiFileSystemModelPrivate::countChildren(const QFileSystemNode *indexNode) const
+{
+    int count = indexNode->children.count();
+    if (disableRecursiveSort || count == 0)
+        return count;
+    QHash<QString, QFileSystemNode *>::const_iterator iterator;
+    for (iterator = indexNode->children.constBegin() ; iterator != indexNode->children.constEnd() ; ++iterator) {
+        if (iterator.value()->children.count() > 0)
+            count += countChildren(iterator.value());
+    }
+    return count;
+}
+
+/*!
+    \internal
+
+    Copies the children of \a indexNode into \a job, then those of its
+    subdirectories unless disableRecursiveSort is set. Names are only
+    copied, sharing their data with the nodes, if name filters need them.
+*/
+void UiFileSystemModelPrivate::snapshotChildren(QFileSystemNode *indexNode, UiFileSystemRefilter *job)
+{
+    if (indexNode->children.count() == 0)
+        return;
+
+    UiRefilterDirectory directory;
+    directory.node = indexNode;
+    directory.first = job->entries.count();
+    directory.count = indexNode->children.count();
+    job->directories.append(directory);
+
+    QHash<QString, QFileSystemNode *>::const_iterator iterator;
+    for (iterator = indexNode->children.constBegin() ; iterator != indexNode->children.constEnd() ; ++iterator) {
+        const QFileSystemNode *child = iterator.value();
+        UiRefilterEntry entry;
+        entry.node = iterator.value();
+        if (job->matchesNames)
+            entry.fileName = child->fileName;
+        entry.attributes = child->attributes;
+        entry.hasInformation = child->hasInformation();
+        entry.isDir = child->isDir();
+        // always accept drives
+        entry.bypass = indexNode == &root || bypassFilters.contains(child);
+        entry.directory = -1;
+        job->entries.append(entry);
+    }
+
+    if (disableRecursiveSort)
+        return;
+    for (int i = directory.first; i < directory.first + directory.count; ++i) {
+        QFileSystemNode *child = job->entries.at(i).node;
+        if (child->children.count() > 0) {
+            job->entries[i].directory = job->directories.count();
+            snapshotChildren(child, job);
+        }
+    }
+}
+
+/*!
+    \internal
+
+    Drops the result of the running refilter(), if any.
+*/
+void UiFileSystemModelPrivate::cancelRefilter()
+{
+    if (refilterJob) {
+        refilterJob->cancel();
+        refilterJob.clear();
+    }
+}
+
+/*!
+    \internal
+
+    Applies what refilter() found, unless nodes changed meanwhile, in which
+    case some of those it refers to may be gone. The children that stay
+    visible keep their order and the newly accepted ones are merged in.
+*/
+void UiFileSystemModelPrivate::_q_refiltered()
+{
+    Q_Q(UiFileSystemModel);
+    // a result that was cancelled too late, the current one is still running
+    if (!refilterJob || !refilterJob->isFinished())
+        return;
+    QSharedPointer<UiFileSystemRefilter> job = refilterJob;
+    refilterJob.clear();
+    if (job->nodesGeneration != nodesGeneration) {
+        forceSort = true;
+        delayedSort();
+        return;
+    }
+
+    emit q->layoutAboutToBeChanged();
+    QModelIndexList oldList = q->persistentIndexList();
+    QList<QPair<QFileSystemNode *, int> > oldNodes;
+    for (int i = 0; i < oldList.count(); ++i)
+        oldNodes.append(QPair<QFileSystemNode *, int>(node(oldList.at(i)), oldList.at(i).column()));
+
+    UiFileSystemModelSorter ms(sortColumn);
+    bool unsorted = false;
+    for (int i = 0; i < job->directories.count(); ++i) {
+        if (!job->filtered.at(i))
+            continue;
+        QFileSystemNode *indexNode = job->directories.at(i).node;
+        const QVector<QFileSystemNode *> &accepted = job->accepted.at(i);
+        QVector<QFileSystemNode *> &visible = indexNode->visibleChildren;
+
+        QVector<bool> stays(visible.count(), false);
+        QVector<QFileSystemNode *> added;
+        for (int j = 0; j < accepted.count(); ++j) {
+            if (accepted.at(j)->isVisible)
+                stays[accepted.at(j)->visibleIndex] = true;
+            else
+                added.append(accepted.at(j));
+        }
+        QVector<QFileSystemNode *> kept;
+        kept.reserve(accepted.count() - added.count());
+        for (int j = 0; j < visible.count(); ++j) {
+            if (stays.at(j)) {
+                kept.append(visible.at(j));
+            } else {
+                visible.at(j)->isVisible = false;
+                visible.at(j)->visibleIndex = -1;
+            }
+        }
+
+        // rows appended since the last sort are out of order, a full sort follows
+        if (indexNode->dirtyChildrenIndex != -1)
+            unsorted = true;
+        sortNodes(&added, ms);
+        QVector<QFileSystemNode *> merged = mergeSorted(kept.constBegin(), kept.constEnd(),
+                                                        added.constBegin(), added.constEnd(), ms);
+        visible.swap(merged);
+        indexNode->dirtyChildrenIndex = -1;
+        for (int j = 0; j < added.count(); ++j)
+            added.at(j)->isVisible = true;
+        indexNode->updateVisibleIndexes(0);
+
+        if (!added.isEmpty() && (sortColumn == 1 || sortColumn == 3))
+            requestChildDetails(indexNode, index(indexNode));
+    }
+
+    QModelIndexList newList;
+    for (int i = 0; i < oldNodes.count(); ++i) {
+        QModelIndex idx = index(oldNodes.at(i).first);
+        newList.append(idx.sibling(idx.row(), oldNodes.at(i).second));
+    }
+    q->changePersistentIndexList(oldList, newList);
+    emit q->layoutChanged();
+
+    if (unsorted) {
+        forceSort = true;
+        delayedSort();
+    }
+}
+
 /*!
     Returns a list of MIME types that can be used to describe a list of items
     in the model.
@@ -1287,8 +2015,8 @@ QModelIndex UiFileSystemModel::mkdir(const QModelIndex &parent, const QString &n
     d->addNode(parentNode, name, QFileInfo());
     Q_ASSERT(parentNode->children.contains(name));
     UiFileSystemModelPrivate::QFileSystemNode *node = parentNode->children[name];
-    node->populate(d->fileInfoGatherer.getInfo(QFileInfo(dir.absolutePath() + QDir::separator() + name)));
-    d->addVisibleFiles(parentNode, QStringList(name));
+    d->populateNode(node, d->fileInfoGatherer.getInfo(QFileInfo(dir.absolutePath() + QDir::separator() + name)));
+    d->addVisibleFiles(parentNode, QVector<UiFileSystemModelPrivate::QFileSystemNode *>() << node);
     return d->index(node);
 }
 
@@ -1355,6 +2083,8 @@ QModelIndex UiFileSystemModel::setRootPath(const QString &newPath)
     if (!rootPath().isEmpty() && rootPath() != QLatin1String(".")) {
         //This remove the watcher for the old rootPath
         d->fileInfoGatherer.removePath(rootPath());
+        //Nobody waits for the old rootPath anymore
+        d->fileInfoGatherer.cancel(rootPath());
         //This line "marks" the node as dirty, so the next fetchMore
         //call on the path will ask the gatherer to install a watcher again
         //But it doesn't re-fetch everything
@@ -1370,6 +2100,7 @@ QModelIndex UiFileSystemModel::setRootPath(const QString &newPath)
     } else {
         newRootIndex = d->index(newPathDir.path());
     }
+    d->fileInfoGatherer.prioritize(filePath(newRootIndex));
     fetchMore(newRootIndex);
     emit rootPathChanged(longNewPath);
     d->forceSort = true;
@@ -1416,10 +2147,10 @@ void UiFileSystemModel::setFilter(QDir::Filters filters)
     if (d->filters == filters)
         return;
     d->filters = filters;
-    // CaseSensitivity might have changed
+    d->updateDetailsPolicy();
+    d->updateFilterMask();
+    // CaseSensitivity might have changed, this refilters too
     setNameFilters(nameFilters());
-    d->forceSort = true;
-    d->delayedSort();
 }
 
 /*!
@@ -1489,8 +2220,7 @@ void UiFileSystemModel::setNameFilterDisables(bool enable)
     if (d->nameFilterDisables == enable)
         return;
     d->nameFilterDisables = enable;
-    d->forceSort = true;
-    d->delayedSort();
+    d->refilter();
 }
 
 bool UiFileSystemModel::nameFilterDisables() const
@@ -1499,14 +2229,68 @@ bool UiFileSystemModel::nameFilterDisables() const
     return d->nameFilterDisables;
 }
 
+/*!
+    \property UiFileSystemModel::detailsOnDemand
+    \brief Whether size, modification time and permissions are only fetched when needed
+
+    When enabled, listing a directory only gathers the names and types of its
+    entries where the platform allows doing so without reading each file's
+    status. The size, modification time and permissions of a file are then
+    fetched when they are first asked for, e.g. when a view shows the size
+    column for it, or for all files of a directory sorted by size or date.
+    Until then they read as empty.
+
+    Filters on permissions need them for every file, so listings keep
+    gathering everything while such a filter is set.
+
+    This property is false by default
+*/
+void UiFileSystemModel::setDetailsOnDemand(bool enable)
+{
+    Q_D(UiFileSystemModel);
+    if (d->detailsOnDemand == enable)
+        return;
+    d->detailsOnDemand = enable;
+    d->updateDetailsPolicy();
+}
+
+bool UiFileSystemModel::detailsOnDemand() const
+{
+    Q_D(const UiFileSystemModel);
+    return d->detailsOnDemand;
+}
+
+/*!
+    \property UiFileSystemModel::updateInterval
+    \brief How often, in milliseconds, new rows of a directory being read are added
+
+    The first rows of a directory are added after at most 100 entries have
+    been read or one interval has passed. Further rows are added once per
+    interval, and less often while the model is still busy with the previous
+    ones, so that reading a huge directory doesn't flood the event loop.
+
+    The default value is 200.
+*/
+void UiFileSystemModel::setUpdateInterval(int msecs)
+{
+    Q_D(UiFileSystemModel);
+    d->fileInfoGatherer.setUpdateInterval(msecs);
+}
+
+int UiFileSystemModel::updateInterval() const
+{
+    Q_D(const UiFileSystemModel);
+    return d->fileInfoGatherer.updateInterval();
+}
+
 /*!
     Sets the name \a filters to apply against the existing files.
 */
 void UiFileSystemModel::setNameFilters(const QStringList &filters)
 {
+    Q_D(UiFileSystemModel);
     // Prep the regexp's ahead of time
 #ifndef QT_NO_REGEXP
-    Q_D(UiFileSystemModel);
 
     if (!d->bypassFilters.isEmpty()) {
         // update the bypass filter to only bypass the stuff that must be kept around
@@ -1527,15 +2311,13 @@ void UiFileSystemModel::setNameFilters(const QStringList &filters)
         }
     }
 
-    d->nameFilters.clear();
     const Qt::CaseSensitivity caseSensitive =
         (filter() & QDir::CaseSensitive) ? Qt::CaseSensitive : Qt::CaseInsensitive;
-    for (int i = 0; i < filters.size(); ++i) {
-        d->nameFilters << QRegExp(filters.at(i), caseSensitive, QRegExp::Wildcard);
-    }
-    d->forceSort = true;
-    d->delayedSort();
+    d->nameFilters.setPatterns(filters, caseSensitive);
+#else
+    Q_UNUSED(filters);
 #endif
+    d->refilter();
 }
 
 /*!
@@ -1544,13 +2326,11 @@ void UiFileSystemModel::setNameFilters(const QStringList &filters)
 QStringList UiFileSystemModel::nameFilters() const
 {
     Q_D(const UiFileSystemModel);
-    QStringList filters;
 #ifndef QT_NO_REGEXP
-    for (int i = 0; i < d->nameFilters.size(); ++i) {
-         filters << d->nameFilters.at(i).pattern();
-    }
+    return d->nameFilters.patterns();
+#else
+    return QStringList();
 #endif
-    return filters;
 }
 
 /*!
@@ -1601,6 +2381,22 @@ void UiFileSystemModelPrivate::_q_directoryChanged(const QString &directory, con
         removeNode(parentNode, toRemove[i]);
 }
 
+/*!
+    \internal
+
+    The watcher saw \a files disappear from \a directory
+*/
+void UiFileSystemModelPrivate::_q_filesRemoved(const QString &directory, const QStringList &files)
+{
+    UiFileSystemModelPrivate::QFileSystemNode *parentNode = node(directory, false);
+    if (parentNode->children.isEmpty())
+        return;
+    for (int i = 0; i < files.count(); ++i) {
+        if (parentNode->children.contains(files.at(i)))
+            removeNode(parentNode, files.at(i));
+    }
+}
+
 /*!
     \internal
 
@@ -1608,12 +2404,12 @@ void UiFileSystemModelPrivate::_q_directoryChanged(const QString &directory, con
 
     *WARNING* this will change the count of children
 */
-UiFileSystemModelPrivate::QFileSystemNode* UiFileSystemModelPrivate::addNode(QFileSystemNode *parentNode, const QString &fileName, const QFileInfo& info)
+UiFileSystemModelPrivate::QFileSystemNode* UiFileSystemModelPrivate::addNode(QFileSystemNode *parentNode, const QString &fileName, const UiExtendedInformation &info)
 {
     // In the common case, itemLocation == count() so check there first
     UiFileSystemModelPrivate::QFileSystemNode *node = new UiFileSystemModelPrivate::QFileSystemNode(fileName, parentNode);
 #ifndef QT_NO_FILESYSTEMWATCHER
-    node->populate(info);
+    populateNode(node, info);
 #endif
 #if defined(Q_OS_WIN) && !defined(Q_OS_WINCE)
     //The parentNode is "" so we are listing the drives
@@ -1631,6 +2427,23 @@ UiFileSystemModelPrivate::QFileSystemNode* UiFileSystemModelPrivate::addNode(QFi
     return node;
 }
 
+/*!
+    \internal
+
+    Sets the information of \a node. Type names are shared by all nodes,
+    as most files of a directory have one of a few.
+*/
+void UiFileSystemModelPrivate::populateNode(QFileSystemNode *node, const UiExtendedInformation &info)
+{
+    node->populate(info);
+    ++nodesGeneration;
+    QSet<QString>::const_iterator it = displayTypes.constFind(info.displayType);
+    if (it != displayTypes.constEnd())
+        node->info.displayType = *it;
+    else
+        displayTypes.insert(info.displayType);
+}
+
 /*!
     \internal
 
@@ -1645,15 +2458,19 @@ void UiFileSystemModelPrivate::removeNode(UiFileSystemModelPrivate::QFileSystemN
     QModelIndex parent = index(parentNode);
     bool indexHidden = isHiddenByFilter(parentNode, parent);
 
-    int vLocation = parentNode->visibleLocation(name);
+    QFileSystemNode *node = parentNode->children.value(name);
+    int vLocation = parentNode->visibleLocation(node);
     if (vLocation >= 0 && !indexHidden)
         q->beginRemoveRows(parent, translateVisibleLocation(parentNode, vLocation),
                                        translateVisibleLocation(parentNode, vLocation));
-    QFileSystemNode * node = parentNode->children.take(name);
+    parentNode->children.remove(name);
     delete node;
+    ++nodesGeneration;
     // cleanup sort files after removing rather then re-sorting which is O(n)
-    if (vLocation >= 0)
+    if (vLocation >= 0) {
         parentNode->visibleChildren.removeAt(vLocation);
+        parentNode->updateVisibleIndexes(vLocation);
+    }
     if (vLocation >= 0 && !indexHidden)
         q->endRemoveRows();
 }
@@ -1686,7 +2503,7 @@ private:
 
     *WARNING* this will change the visible count
  */
-void UiFileSystemModelPrivate::addVisibleFiles(QFileSystemNode *parentNode, const QStringList &newFiles)
+void UiFileSystemModelPrivate::addVisibleFiles(QFileSystemNode *parentNode, const QVector<QFileSystemNode *> &newFiles)
 {
     Q_Q(UiFileSystemModel);
     QModelIndex parent = index(parentNode);
@@ -1699,13 +2516,116 @@ void UiFileSystemModelPrivate::addVisibleFiles(QFileSystemNode *parentNode, cons
         parentNode->dirtyChildrenIndex = parentNode->visibleChildren.count();
 
     for (int i = 0; i < newFiles.count(); ++i) {
+            newFiles.at(i)->visibleIndex = parentNode->visibleChildren.count();
             parentNode->visibleChildren.append(newFiles.at(i));
-            parentNode->children[newFiles.at(i)]->isVisible = true;
+            newFiles.at(i)->isVisible = true;
         }
     if (!indexHidden)
       q->endInsertRows();
 }
 
+// Beyond this many runs of new rows, one layout change is cheaper for the views
+static const int maxInsertRuns = 32;
+
+/*!
+    \internal
+
+    Files in \a newFiles were not visible before, but now should be. Unlike
+    addVisibleFiles(), which appends them and leaves the order to a full
+    sort, this sorts only the new files and merges them into the already
+    sorted visible children, emitting one insert per run of rows that land
+    next to each other.
+
+    *WARNING* this will change the visible count
+ */
+void UiFileSystemModelPrivate::insertVisibleFiles(QFileSystemNode *parentNode, QVector<QFileSystemNode *> newFiles)
+{
+    Q_Q(UiFileSystemModel);
+    Q_ASSERT(parentNode->dirtyChildrenIndex == -1);
+    UiFileSystemModelSorter ms(sortColumn);
+    sortNodes(&newFiles, ms);
+
+    // where each new file goes, after the visible ones that compare equal
+    QVector<QFileSystemNode *> &visible = parentNode->visibleChildren;
+    QVector<int> positions(newFiles.count());
+    int runs = 0;
+    QVector<QFileSystemNode *>::iterator from = visible.begin();
+    for (int i = 0; i < newFiles.count(); ++i) {
+        UiSortItem item;
+        item.node = newFiles.at(i);
+        item.key = ms.sortKey(item.node);
+        from = qUpperBound(from, visible.end(), item, ms);
+        positions[i] = from - visible.begin();
+        if (i == 0 || positions.at(i) != positions.at(i - 1))
+            ++runs;
+    }
+
+    if (runs > maxInsertRuns) {
+        mergeVisibleFiles(parentNode, newFiles);
+        return;
+    }
+
+    QModelIndex parent = index(parentNode);
+    bool indexHidden = isHiddenByFilter(parentNode, parent);
+    // from the last run back, so that the positions of the others stay valid
+    int end = newFiles.count();
+    while (end > 0) {
+        const int position = positions.at(end - 1);
+        int begin = end - 1;
+        while (begin > 0 && positions.at(begin - 1) == position)
+            --begin;
+        const int count = end - begin;
+        const int row = sortOrder == Qt::AscendingOrder ? position : visible.count() - position;
+        if (!indexHidden)
+            q->beginInsertRows(parent, row, row + count - 1);
+        visible.insert(position, count, 0);
+        for (int i = 0; i < count; ++i) {
+            visible[position + i] = newFiles.at(begin + i);
+            newFiles.at(begin + i)->isVisible = true;
+        }
+        parentNode->updateVisibleIndexes(position);
+        if (!indexHidden)
+            q->endInsertRows();
+        end = begin;
+    }
+}
+
+/*!
+    \internal
+
+    Appends \a newFiles, sorted, and merges them into the visible children of
+    \a parentNode in one pass, telling the views with a layout change as
+    sort() does, but for this directory only.
+ */
+void UiFileSystemModelPrivate::mergeVisibleFiles(QFileSystemNode *parentNode, const QVector<QFileSystemNode *> &newFiles)
+{
+    Q_Q(UiFileSystemModel);
+    addVisibleFiles(parentNode, newFiles);
+    parentNode->dirtyChildrenIndex = -1;
+
+    emit q->layoutAboutToBeChanged();
+    QModelIndexList oldList = q->persistentIndexList();
+    QList<QPair<QFileSystemNode *, int> > oldNodes;
+    for (int i = 0; i < oldList.count(); ++i)
+        oldNodes.append(QPair<QFileSystemNode *, int>(node(oldList.at(i)), oldList.at(i).column()));
+
+    QVector<QFileSystemNode *> &visible = parentNode->visibleChildren;
+    const int sortedCount = visible.count() - newFiles.count();
+    QVector<QFileSystemNode *> merged = mergeSorted(visible.constBegin(), visible.constBegin() + sortedCount,
+                                                    visible.constBegin() + sortedCount, visible.constEnd(),
+                                                    UiFileSystemModelSorter(sortColumn));
+    visible.swap(merged);
+    parentNode->updateVisibleIndexes(0);
+
+    QModelIndexList newList;
+    for (int i = 0; i < oldNodes.count(); ++i) {
+        QModelIndex idx = index(oldNodes.at(i).first);
+        newList.append(idx.sibling(idx.row(), oldNodes.at(i).second));
+    }
+    q->changePersistentIndexList(oldList, newList);
+    emit q->layoutChanged();
+}
+
 /*!
     \internal
 
@@ -1723,8 +2643,10 @@ void UiFileSystemModelPrivate::removeVisibleFile(QFileSystemNode *parentNode, in
     if (!indexHidden)
         q->beginRemoveRows(parent, translateVisibleLocation(parentNode, vLocation),
                                        translateVisibleLocation(parentNode, vLocation));
-    parentNode->children[parentNode->visibleChildren.at(vLocation)]->isVisible = false;
+    parentNode->visibleChildren.at(vLocation)->isVisible = false;
+    parentNode->visibleChildren.at(vLocation)->visibleIndex = -1;
     parentNode->visibleChildren.removeAt(vLocation);
+    parentNode->updateVisibleIndexes(vLocation);
     if (!indexHidden)
         q->endRemoveRows();
 }
@@ -1735,20 +2657,21 @@ void UiFileSystemModelPrivate::removeVisibleFile(QFileSystemNode *parentNode, in
     The thread has received new information about files,
     update and emit dataChanged if it has actually changed.
  */
-void UiFileSystemModelPrivate::_q_fileSystemChanged(const QString &path, const QList<QPair<QString, QFileInfo> > &updates)
+void UiFileSystemModelPrivate::_q_fileSystemChanged(const QString &path, const QList<QPair<QString, UiExtendedInformation> > &updates)
 {
     Q_Q(UiFileSystemModel);
+    fileInfoGatherer.updatesHandled();
     QVector<QString> rowsToUpdate;
-    QStringList newFiles;
+    QVector<QFileSystemNode *> newFiles;
     UiFileSystemModelPrivate::QFileSystemNode *parentNode = node(path, false);
     QModelIndex parentIndex = index(parentNode);
     for (int i = 0; i < updates.count(); ++i) {
         QString fileName = updates.at(i).first;
         Q_ASSERT(!fileName.isEmpty());
-        UiExtendedInformation info = fileInfoGatherer.getInfo(updates.at(i).second);
+        const UiExtendedInformation &info = updates.at(i).second;
         bool previouslyHere = parentNode->children.contains(fileName);
         if (!previouslyHere) {
-            addNode(parentNode, fileName, info.fileInfo());
+            addNode(parentNode, fileName, info);
         }
         UiFileSystemModelPrivate::QFileSystemNode * node = parentNode->children.value(fileName);
         bool isCaseSensitive = parentNode->caseSensitive();
@@ -1761,8 +2684,9 @@ void UiFileSystemModelPrivate::_q_fileSystemChanged(const QString &path, const Q
         }
         if (isCaseSensitive) {
             Q_ASSERT(node->fileName == fileName);
-        } else {
-            node->fileName = fileName;
+        } else if (node->fileName != fileName) {
+            node->setFileName(fileName);
+            ++nodesGeneration;
         }
 
         if (info.size() == -1 && !info.isSymLink()) {
@@ -1770,19 +2694,24 @@ void UiFileSystemModelPrivate::_q_fileSystemChanged(const QString &path, const Q
             continue;
         }
 
-        if (*node != info ) {
-            node->populate(info);
+        // a listing without details doesn't make the ones already fetched stale
+        if (previouslyHere && !info.hasDetails() && node->hasDetails()
+            && node->info.type() == info.type())
+            continue;
+
+        if (!previouslyHere || *node != info) {
+            populateNode(node, info);
             bypassFilters.remove(node);
             // brand new information.
             if (filtersAcceptsNode(node)) {
                 if (!node->isVisible) {
-                    newFiles.append(fileName);
+                    newFiles.append(node);
                 } else {
                     rowsToUpdate.append(fileName);
                 }
             } else {
                 if (node->isVisible) {
-                    int visibleLocation = parentNode->visibleLocation(fileName);
+                    int visibleLocation = parentNode->visibleLocation(node);
                     removeVisibleFile(parentNode, visibleLocation);
                 } else {
                     // The file is not visible, don't do anything
@@ -1792,45 +2721,35 @@ void UiFileSystemModelPrivate::_q_fileSystemChanged(const QString &path, const Q
     }
 
     // bundle up all of the changed signals into as few as possible.
-    qSort(rowsToUpdate.begin(), rowsToUpdate.end());
-    QString min;
-    QString max;
+    QVector<int> changedRows;
+    changedRows.reserve(rowsToUpdate.count());
     for (int i = 0; i < rowsToUpdate.count(); ++i) {
-        QString value = rowsToUpdate.at(i);
-        //##TODO is there a way to bundle signals with QString as the content of the list?
-        /*if (min.isEmpty()) {
-            min = value;
-            if (i != rowsToUpdate.count() - 1)
-                continue;
-        }
-        if (i != rowsToUpdate.count() - 1) {
-            if ((value == min + 1 && max.isEmpty()) || value == max + 1) {
-                max = value;
-                continue;
-            }
-        }*/
-        max = value;
-        min = value;
-        int visibleMin = parentNode->visibleLocation(min);
-        int visibleMax = parentNode->visibleLocation(max);
-        if (visibleMin >= 0
-            && visibleMin < parentNode->visibleChildren.count()
-            && parentNode->visibleChildren.at(visibleMin) == min
-            && visibleMax >= 0) {
-            QModelIndex bottom = q->index(translateVisibleLocation(parentNode, visibleMin), 0, parentIndex);
-            QModelIndex top = q->index(translateVisibleLocation(parentNode, visibleMax), 3, parentIndex);
-            emit q->dataChanged(bottom, top);
-        }
-
-        /*min = QString();
-        max = QString();*/
+        // the node may have been removed by a later update in this batch
+        const int visibleLocation = parentNode->visibleLocation(parentNode->children.value(rowsToUpdate.at(i)));
+        if (visibleLocation >= 0)
+            changedRows.append(translateVisibleLocation(parentNode, visibleLocation));
+    }
+    qSort(changedRows.begin(), changedRows.end());
+    for (int i = 0; i < changedRows.count(); ) {
+        const int first = changedRows.at(i);
+        int last = first;
+        while (++i < changedRows.count() && changedRows.at(i) <= last + 1)
+            last = changedRows.at(i);
+        emit q->dataChanged(q->index(first, 0, parentIndex), q->index(last, 3, parentIndex));
     }
 
+    bool needsSort = sortColumn != 0 && rowsToUpdate.count() > 0;
     if (newFiles.count() > 0) {
-        addVisibleFiles(parentNode, newFiles);
+        // new rows of a sorted directory are merged in, others wait for a full sort
+        if (!forceSort && parentNode->dirtyChildrenIndex == -1) {
+            insertVisibleFiles(parentNode, newFiles);
+        } else {
+            addVisibleFiles(parentNode, newFiles);
+            needsSort = true;
+        }
     }
 
-    if (newFiles.count() > 0 || (sortColumn != 0 && rowsToUpdate.count() > 0)) {
+    if (needsSort) {
         forceSort = true;
         delayedSort();
     }
@@ -1850,11 +2769,13 @@ void UiFileSystemModelPrivate::_q_resolvedName(const QString &fileName, const QS
 void UiFileSystemModelPrivate::init()
 {
     Q_Q(UiFileSystemModel);
-    qRegisterMetaType<QList<QPair<QString,QFileInfo> > >("QList<QPair<QString,QFileInfo> >");
+    qRegisterMetaType<QList<QPair<QString,UiExtendedInformation> > >("QList<QPair<QString,UiExtendedInformation> >");
     q->connect(&fileInfoGatherer, SIGNAL(newListOfFiles(QString,QStringList)),
                q, SLOT(_q_directoryChanged(QString,QStringList)));
-    q->connect(&fileInfoGatherer, SIGNAL(updates(QString,QList<QPair<QString,QFileInfo> >)),
-            q, SLOT(_q_fileSystemChanged(QString,QList<QPair<QString,QFileInfo> >)));
+    q->connect(&fileInfoGatherer, SIGNAL(updates(QString,QList<QPair<QString,UiExtendedInformation> >)),
+            q, SLOT(_q_fileSystemChanged(QString,QList<QPair<QString,UiExtendedInformation> >)));
+    q->connect(&fileInfoGatherer, SIGNAL(filesRemoved(QString,QStringList)),
+               q, SLOT(_q_filesRemoved(QString,QStringList)));
     q->connect(&fileInfoGatherer, SIGNAL(nameResolved(QString,QString)),
             q, SLOT(_q_resolvedName(QString,QString)));
     q->connect(&fileInfoGatherer, SIGNAL(directoryLoaded(QString)),
@@ -1872,9 +2793,6 @@ void UiFileSystemModelPrivate::init()
     \internal
 
     Returns false if node doesn't pass the filters otherwise true
-
-    QDir::Modified is not supported
-    QDir::Drives is not supported
 */
 bool UiFileSystemModelPrivate::filtersAcceptsNode(const QFileSystemNode *node) const
 {
@@ -1886,38 +2804,48 @@ bool UiFileSystemModelPrivate::filtersAcceptsNode(const QFileSystemNode *node) c
     if (!node->hasInformation())
         return false;
 
-    const bool filterPermissions = ((filters & QDir::PermissionMask)
-                                   && (filters & QDir::PermissionMask) != QDir::PermissionMask);
-    const bool hideDirs          = !(filters & (QDir::Dirs | QDir::AllDirs));
-    const bool hideFiles         = !(filters & QDir::Files);
-    const bool hideReadable      = !(!filterPermissions || (filters & QDir::Readable));
-    const bool hideWritable      = !(!filterPermissions || (filters & QDir::Writable));
-    const bool hideExecutable    = !(!filterPermissions || (filters & QDir::Executable));
-    const bool hideHidden        = !(filters & QDir::Hidden);
-    const bool hideSystem        = !(filters & QDir::System);
-    const bool hideSymlinks      = (filters & QDir::NoSymLinks);
-    const bool hideDot           = (filters & QDir::NoDot);
-    const bool hideDotDot        = (filters & QDir::NoDotDot);
-
-    // Note that we match the behavior of entryList and not QFileInfo on this and this
-    // incompatibility won't be fixed until Qt 5 at least
-    bool isDot    = (node->fileName == QLatin1String("."));
-    bool isDotDot = (node->fileName == QLatin1String(".."));
-    if (   (hideHidden && !(isDot || isDotDot) && node->isHidden())
-        || (hideSystem && node->isSystem())
-        || (hideDirs && node->isDir())
-        || (hideFiles && node->isFile())
-        || (hideSymlinks && node->isSymLink())
-        || (hideReadable && node->isReadable())
-        || (hideWritable && node->isWritable())
-        || (hideExecutable && node->isExecutable())
-        || (hideDot && isDot)
-        || (hideDotDot && isDotDot))
+    if (node->attributes & hiddenAttributes)
         return false;
 
     return nameFilterDisables || passNameFilters(node);
 }
 
+/*!
+    \internal
+
+    Turns the filters into the attributes of the nodes they hide, so that
+    filtersAcceptsNode() needs one test whatever the filters
+
+    QDir::Modified is not supported
+    QDir::Drives is not supported
+*/
+void UiFileSystemModelPrivate::updateFilterMask()
+{
+    const bool filterPermissions = ((filters & QDir::PermissionMask)
+                                   && (filters & QDir::PermissionMask) != QDir::PermissionMask);
+    hiddenAttributes = 0;
+    if (!(filters & (QDir::Dirs | QDir::AllDirs)))
+        hiddenAttributes |= DirAttribute;
+    if (!(filters & QDir::Files))
+        hiddenAttributes |= FileAttribute;
+    if (filterPermissions && !(filters & QDir::Readable))
+        hiddenAttributes |= ReadableAttribute;
+    if (filterPermissions && !(filters & QDir::Writable))
+        hiddenAttributes |= WritableAttribute;
+    if (filterPermissions && !(filters & QDir::Executable))
+        hiddenAttributes |= ExecutableAttribute;
+    if (!(filters & QDir::Hidden))
+        hiddenAttributes |= HiddenAttribute;
+    if (!(filters & QDir::System))
+        hiddenAttributes |= SystemAttribute;
+    if (filters & QDir::NoSymLinks)
+        hiddenAttributes |= SymLinkAttribute;
+    if (filters & QDir::NoDot)
+        hiddenAttributes |= DotAttribute;
+    if (filters & QDir::NoDotDot)
+        hiddenAttributes |= DotDotAttribute;
+}
+
 /*
     \internal
 
@@ -1930,17 +2858,106 @@ bool UiFileSystemModelPrivate::passNameFilters(const QFileSystemNode *node) cons
         return true;
 
     // Check the name regularexpression filters
-    if (!(node->isDir() && (filters & QDir::AllDirs))) {
-        for (int i = 0; i < nameFilters.size(); ++i) {
-            if (nameFilters.at(i).exactMatch(node->fileName))
-                return true;
-        }
-        return false;
-    }
+    if (!(node->isDir() && (filters & QDir::AllDirs)))
+        return nameFilters.matches(node->fileName);
 #endif
     return true;
 }
 
+#ifndef QT_NO_REGEXP
+static bool hasWildcards(const QString &pattern, int from, int to)
+{
+    for (int i = from; i < to; ++i) {
+        const QChar c = pattern.at(i);
+        if (c == QLatin1Char('*') || c == QLatin1Char('?') || c == QLatin1Char('[')
+            || c == QLatin1Char(']') || c == QLatin1Char('\\'))
+            return true;
+    }
+    return false;
+}
+
+// The regular expression QRegExp::Wildcard would make of pattern
+static QString wildcardToRegExp(const QString &pattern)
+{
+    QString rx;
+    for (int i = 0; i < pattern.length(); ++i) {
+        const QChar c = pattern.at(i);
+        if (c == QLatin1Char('*')) {
+            rx += QLatin1String(".*");
+        } else if (c == QLatin1Char('?')) {
+            rx += QLatin1Char('.');
+        } else if (c == QLatin1Char('[')) {
+            const int end = pattern.indexOf(QLatin1Char(']'), i + 2);
+            if (end == -1) {
+                rx += QLatin1String("\\[");
+                continue;
+            }
+            QString set = pattern.mid(i + 1, end - i - 1);
+            if (set.startsWith(QLatin1Char('!')))
+                set[0] = QLatin1Char('^');
+            set.replace(QLatin1Char('\\'), QLatin1String("\\\\"));
+            rx += QLatin1Char('[') + set + QLatin1Char(']');
+            i = end;
+        } else {
+            rx += QRegExp::escape(QString(c));
+        }
+    }
+    return rx;
+}
+
+void UiNameFilterMatcher::setPatterns(const QStringList &patterns, Qt::CaseSensitivity caseSensitivity)
+{
+    m_patterns = patterns;
+    cs = caseSensitivity;
+    matchAll = false;
+    exact.clear();
+    suffixes.clear();
+    suffixLengths.clear();
+    prefixes.clear();
+    prefixLengths.clear();
+
+    QStringList others;
+    foreach (const QString &pattern, patterns) {
+        const int length = pattern.length();
+        if (pattern == QLatin1String("*")) {
+            matchAll = true;
+        } else if (!hasWildcards(pattern, 0, length)) {
+            exact.insert(fold(pattern));
+        } else if (pattern.startsWith(QLatin1Char('*')) && !hasWildcards(pattern, 1, length)) {
+            suffixes.insert(fold(pattern.mid(1)));
+            if (!suffixLengths.contains(length - 1))
+                suffixLengths.append(length - 1);
+        } else if (pattern.endsWith(QLatin1Char('*')) && !hasWildcards(pattern, 0, length - 1)) {
+            prefixes.insert(fold(pattern.left(length - 1)));
+            if (!prefixLengths.contains(length - 1))
+                prefixLengths.append(length - 1);
+        } else {
+            others.append(QLatin1String("(?:") + wildcardToRegExp(pattern) + QLatin1Char(')'));
+        }
+    }
+    this->others = others.isEmpty() ? QRegExp() : QRegExp(others.join(QLatin1String("|")), cs);
+}
+
+bool UiNameFilterMatcher::matches(const QString &name) const
+{
+    if (matchAll)
+        return true;
+    if (!exact.isEmpty() && exact.contains(fold(name)))
+        return true;
+    for (int i = 0; i < suffixLengths.count(); ++i) {
+        const int length = suffixLengths.at(i);
+        if (length <= name.length() && suffixes.contains(fold(name.right(length))))
+            return true;
+    }
+    for (int i = 0; i < prefixLengths.count(); ++i) {
+        const int length = prefixLengths.at(i);
+        if (length <= name.length() && prefixes.contains(fold(name.left(length))))
+            return true;
+    }
+    return !others.isEmpty() && others.exactMatch(name);
+}
+#endif
+
 QT_END_NAMESPACE_UIHELPERS
 
 #include "moc_uifilesystemmodel.cpp"
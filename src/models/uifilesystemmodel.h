@@ -64,6 +64,8 @@ class UIHELPERS_EXPORT UiFileSystemModel : public QAbstractItemModel
     Q_PROPERTY(bool resolveSymlinks READ resolveSymlinks WRITE setResolveSymlinks)
     Q_PROPERTY(bool readOnly READ isReadOnly WRITE setReadOnly)
     Q_PROPERTY(bool nameFilterDisables READ nameFilterDisables WRITE setNameFilterDisables)
+    Q_PROPERTY(bool detailsOnDemand READ detailsOnDemand WRITE setDetailsOnDemand)
+    Q_PROPERTY(int updateInterval READ updateInterval WRITE setUpdateInterval)
 
 Q_SIGNALS:
     void rootPathChanged(const QString &newPath);
@@ -123,6 +125,12 @@ public:
     void setNameFilterDisables(bool enable);
     bool nameFilterDisables() const;
 
+    void setDetailsOnDemand(bool enable);
+    bool detailsOnDemand() const;
+
+    void setUpdateInterval(int msecs);
+    int updateInterval() const;
+
     void setNameFilters(const QStringList &filters);
     QStringList nameFilters() const;
 
@@ -149,9 +157,11 @@ private:
     Q_DISABLE_COPY(UiFileSystemModel)
 
     Q_PRIVATE_SLOT(d_func(), void _q_directoryChanged(const QString &directory, const QStringList &list))
+    Q_PRIVATE_SLOT(d_func(), void _q_filesRemoved(const QString &directory, const QStringList &files))
     Q_PRIVATE_SLOT(d_func(), void _q_performDelayedSort())
-    Q_PRIVATE_SLOT(d_func(), void _q_fileSystemChanged(const QString &path, const QList<QPair<QString, QFileInfo> > &))
+    Q_PRIVATE_SLOT(d_func(), void _q_fileSystemChanged(const QString &path, const QList<QPair<QString, UiExtendedInformation> > &))
     Q_PRIVATE_SLOT(d_func(), void _q_resolvedName(const QString &fileName, const QString &resolvedName))
+    Q_PRIVATE_SLOT(d_func(), void _q_refiltered())
 
     friend class QFileDialogPrivate;
 };
@@ -65,31 +65,78 @@
 #include <qfileinfo.h>
 #include <qtimer.h>
 #include <qhash.h>
+#include <qvector.h>
+#include <qset.h>
+#include <qregexp.h>
+#include <qsharedpointer.h>
 
 
 QT_BEGIN_NAMESPACE_UIHELPERS
 
 class ExtendedInformation;
 class UiFileSystemModelPrivate;
+class UiFileSystemRefilter;
+struct UiNaturalSortTable;
+
+#ifndef QT_NO_REGEXP
+/*
+    Matches file names against wildcard patterns like QRegExp::Wildcard,
+    looking the common forms "name", "*.suffix" and "prefix*" up in sets
+    and running the others as one combined regular expression.
+*/
+class Q_AUTOTEST_EXPORT UiNameFilterMatcher
+{
+public:
+    UiNameFilterMatcher() : cs(Qt::CaseInsensitive), matchAll(false) {}
+
+    void setPatterns(const QStringList &patterns, Qt::CaseSensitivity cs);
+    QStringList patterns() const { return m_patterns; }
+    bool isEmpty() const { return m_patterns.isEmpty(); }
+    bool matches(const QString &name) const;
+
+private:
+    QString fold(const QString &s) const { return cs == Qt::CaseSensitive ? s : s.toLower(); }
+
+    QStringList m_patterns;
+    Qt::CaseSensitivity cs;
+    bool matchAll;
+    QSet<QString> exact;
+    QSet<QString> suffixes;
+    QVector<int> suffixLengths;
+    QSet<QString> prefixes;
+    QVector<int> prefixLengths;
+    QRegExp others;
+};
+#endif
 
 class Q_AUTOTEST_EXPORT UiFileSystemModelPrivate : public QAbstractItemModelPrivate
 {
     Q_DECLARE_PUBLIC(UiFileSystemModel)
 
 public:
+    enum Attribute {
+        DirAttribute = 0x1,
+        FileAttribute = 0x2,
+        SystemAttribute = 0x4,
+        HiddenAttribute = 0x8,
+        SymLinkAttribute = 0x10,
+        ReadableAttribute = 0x20,
+        WritableAttribute = 0x40,
+        ExecutableAttribute = 0x80,
+        DotAttribute = 0x100,
+        DotDotAttribute = 0x200,
+        // not seen by the filters, set while requestDetails() waits for a reply
+        DetailsRequestedAttribute = 0x400
+    };
+
     class QFileSystemNode
     {
     public:
         QFileSystemNode(const QString &filename = QString(), QFileSystemNode *p = 0)
-            : fileName(filename), populatedChildren(false), isVisible(false), dirtyChildrenIndex(-1), parent(p), info(0) {}
+            : fileName(filename), populatedChildren(false), isVisible(false), hasInfo(false), attributes(0),
+              dirtyChildrenIndex(-1), visibleIndex(-1), parent(p) {}
         ~QFileSystemNode() {
-            QHash<QString, QFileSystemNode*>::const_iterator i = children.constBegin();
-            while (i != children.constEnd()) {
-                    delete i.value();
-                    ++i;
-            }
-            delete info;
-            info = 0;
+            qDeleteAll(children);
             parent = 0;
         }
 
@@ -98,25 +145,25 @@ public:
         QString volumeName;
 #endif
 
-        inline qint64 size() const { if (info && !info->isDir()) return info->size(); return 0; }
-        inline QString type() const { if (info) return info->displayType; return QLatin1String(""); }
-        inline QDateTime lastModified() const { if (info) return info->lastModified(); return QDateTime(); }
-        inline QFile::Permissions permissions() const { if (info) return info->permissions(); return 0; }
+        inline qint64 size() const { if (hasInfo && !info.isDir()) return info.size(); return 0; }
+        inline QString type() const { if (hasInfo) return info.displayType; return QLatin1String(""); }
+        inline QDateTime lastModified() const { if (hasInfo) return info.lastModified(); return QDateTime(); }
+        inline QFile::Permissions permissions() const { if (hasInfo) return info.permissions(); return 0; }
         inline bool isReadable() const { return ((permissions() & QFile::ReadUser) != 0); }
         inline bool isWritable() const { return ((permissions() & QFile::WriteUser) != 0); }
         inline bool isExecutable() const { return ((permissions() & QFile::ExeUser) != 0); }
         inline bool isDir() const {
-            if (info)
-                return info->isDir();
+            if (hasInfo)
+                return info.isDir();
             if (children.count() > 0)
                 return true;
             return false;
         }
-        inline bool isFile() const { if (info) return info->isFile(); return true; }
-        inline bool isSystem() const { if (info) return info->isSystem(); return true; }
-        inline bool isHidden() const { if (info) return info->isHidden(); return false; }
-        inline bool isSymLink() const { if (info) return info->isSymLink(); return false; }
-        inline bool caseSensitive() const { if (info) return info->isCaseSensitive(); return false; }
+        inline bool isFile() const { if (hasInfo) return info.isFile(); return true; }
+        inline bool isSystem() const { if (hasInfo) return info.isSystem(); return true; }
+        inline bool isHidden() const { if (hasInfo) return info.isHidden(); return false; }
+        inline bool isSymLink() const { if (hasInfo) return info.isSymLink(); return false; }
+        inline bool caseSensitive() const { if (hasInfo) return info.isCaseSensitive(); return false; }
 
         inline bool operator <(const QFileSystemNode &node) const {
             if (caseSensitive() || node.caseSensitive())
@@ -142,20 +189,68 @@ public:
             return QString::compare(fileName, name, Qt::CaseInsensitive) == 0;
         }
         bool operator ==(const UiExtendedInformation &fileInfo) const {
-            return info && (*info == fileInfo);
+            return hasInfo && info == fileInfo;
         }
 
-        inline bool hasInformation() const { return info != 0; }
+        inline bool hasInformation() const { return hasInfo; }
+        inline bool hasDetails() const { return hasInfo && info.hasDetails(); }
 
         void populate(const UiExtendedInformation &fileInfo) {
-            if (!info)
-                info = new UiExtendedInformation(fileInfo.fileInfo());
-            (*info) = fileInfo;
+            info = fileInfo;
+            hasInfo = true;
+            if (fileInfo.hasDetails())
+                attributes &= ~DetailsRequestedAttribute;
+            updateAttributes();
+        }
+
+        void setFileName(const QString &name) {
+            fileName = name;
+            updateAttributes();
+        }
+
+        // what filtersAcceptsNode() checks, as a mask of Attribute
+        void updateAttributes() {
+            attributes &= DetailsRequestedAttribute;
+            const bool isDot = fileName == QLatin1String(".");
+            const bool isDotDot = fileName == QLatin1String("..");
+            if (isDot)
+                attributes |= DotAttribute;
+            if (isDotDot)
+                attributes |= DotDotAttribute;
+            if (!hasInfo)
+                return;
+            // Note that we match the behavior of entryList and not QFileInfo on this
+            if (info.isHidden() && !(isDot || isDotDot))
+                attributes |= HiddenAttribute;
+            if (info.isSystem())
+                attributes |= SystemAttribute;
+            if (info.isDir())
+                attributes |= DirAttribute;
+            if (info.isFile())
+                attributes |= FileAttribute;
+            if (info.isSymLink())
+                attributes |= SymLinkAttribute;
+            const QFile::Permissions permissions = info.permissions();
+            if (permissions & QFile::ReadUser)
+                attributes |= ReadableAttribute;
+            if (permissions & QFile::WriteUser)
+                attributes |= WritableAttribute;
+            if (permissions & QFile::ExeUser)
+                attributes |= ExecutableAttribute;
         }
 
         // children shouldn't normally be accessed directly, use node()
-        inline int visibleLocation(QString childName) {
-            return visibleChildren.indexOf(childName);
+        inline int visibleLocation(const QFileSystemNode *child) const {
+            if (!child || !child->isVisible)
+                return -1;
+            Q_ASSERT(visibleChildren.at(child->visibleIndex) == child);
+            return child->visibleIndex;
+        }
+
+        // keeps visibleIndex of the visible children from \a from on in step
+        inline void updateVisibleIndexes(int from) {
+            for (int i = from; i < visibleChildren.count(); ++i)
+                visibleChildren.at(i)->visibleIndex = i;
         }
 
 //        void retranslateStrings(const QString &path) {
@@ -176,14 +271,20 @@ public:
 
         bool populatedChildren;
         bool isVisible;
-        QHash<QString,QFileSystemNode *> children;
-        QList<QString> visibleChildren;
+        bool hasInfo;
+        ushort attributes;
         int dirtyChildrenIndex;
+        int visibleIndex; // position in the parent's visibleChildren, -1 if not visible
+        // the hash is the name index, its keys share their data with fileName.
+        // Each child is a heap node of its own because model indexes and the
+        // gatherer's updates hold on to node pointers, which a contiguous
+        // array of children would move whenever it grows.
+        QHash<QString,QFileSystemNode *> children;
+        QVector<QFileSystemNode *> visibleChildren;
         QFileSystemNode *parent;
 
-
-        UiExtendedInformation *info;
-
+        // stored inline, valid when hasInfo is set
+        UiExtendedInformation info;
     };
 
     UiFileSystemModelPrivate() :
@@ -194,9 +295,13 @@ public:
             setRootPath(false),
             filters(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::AllDirs),
             nameFilterDisables(true), // false on windows, true on mac and unix
-            disableRecursiveSort(false)
+            disableRecursiveSort(false),
+            detailsOnDemand(false),
+            hiddenAttributes(0),
+            nodesGeneration(0)
     {
         delayedSortTimer.setSingleShot(true);
+        updateFilterMask();
     }
 
     void init();
@@ -216,10 +321,29 @@ public:
     bool filtersAcceptsNode(const QFileSystemNode *node) const;
     bool passNameFilters(const QFileSystemNode *node) const;
     void removeNode(QFileSystemNode *parentNode, const QString &name);
-    QFileSystemNode* addNode(QFileSystemNode *parentNode, const QString &fileName, const QFileInfo &info);
-    void addVisibleFiles(QFileSystemNode *parentNode, const QStringList &newFiles);
+    QFileSystemNode* addNode(QFileSystemNode *parentNode, const QString &fileName, const UiExtendedInformation &info);
+    void addVisibleFiles(QFileSystemNode *parentNode, const QVector<QFileSystemNode *> &newFiles);
+    void insertVisibleFiles(QFileSystemNode *parentNode, QVector<QFileSystemNode *> newFiles);
+    void mergeVisibleFiles(QFileSystemNode *parentNode, const QVector<QFileSystemNode *> &newFiles);
+    void populateNode(QFileSystemNode *node, const UiExtendedInformation &info);
     void removeVisibleFile(QFileSystemNode *parentNode, int visibleLocation);
+    // the children of one directory to be sorted, see sortChildren()
+    struct SortJob {
+        QFileSystemNode *node;
+        QVector<QFileSystemNode *> children;
+    };
+
     void sortChildren(int column, const QModelIndex &parent);
+    void collectSortJobs(QFileSystemNode *indexNode, QVector<SortJob> *jobs);
+    void requestDetails(const QFileSystemNode *node) const;
+    void requestChildDetails(QFileSystemNode *parentNode, const QModelIndex &parent);
+    void requestTreeDetails(QFileSystemNode *parentNode);
+    void updateDetailsPolicy();
+    void updateFilterMask();
+    void refilter();
+    int countChildren(const QFileSystemNode *indexNode) const;
+    void snapshotChildren(QFileSystemNode *indexNode, UiFileSystemRefilter *job);
+    void cancelRefilter();
 
     inline int translateVisibleLocation(QFileSystemNode *parent, int row) const {
         if (sortOrder != Qt::AscendingOrder) {
@@ -269,11 +393,17 @@ public:
     QString time(const QModelIndex &index) const;
 
     void _q_directoryChanged(const QString &directory, const QStringList &list);
+    void _q_filesRemoved(const QString &directory, const QStringList &files);
     void _q_performDelayedSort();
-    void _q_fileSystemChanged(const QString &path, const QList<QPair<QString, QFileInfo> > &);
+    void _q_fileSystemChanged(const QString &path, const QList<QPair<QString, UiExtendedInformation> > &);
     void _q_resolvedName(const QString &fileName, const QString &resolvedName);
+    void _q_refiltered();
 
     static int naturalCompare(const QString &s1, const QString &s2, Qt::CaseSensitivity cs);
+    static const UiNaturalSortTable *naturalSortTable();
+    static QByteArray naturalSortKey(const QString &name, const UiNaturalSortTable *table = 0);
+    static int compareNaturalSortKeys(const QByteArray &key1, const QByteArray &key2,
+                                      const UiNaturalSortTable *table = 0);
 
     QDir rootDir;
 #ifndef QT_NO_FILESYSTEMWATCHER
@@ -287,14 +417,23 @@ public:
     bool setRootPath;
     QDir::Filters filters;
     QHash<const QFileSystemNode*, bool> bypassFilters;
+    // one copy of each type name, shared by the nodes
+    QSet<QString> displayTypes;
     bool nameFilterDisables;
     //This flag is an optimization for the QFileDialog
     //It enable a sort which is not recursive, it means
     //we sort only what we see.
     bool disableRecursiveSort;
+    bool detailsOnDemand;
+    // nodes with any of these attributes don't pass the filters
+    ushort hiddenAttributes;
 #ifndef QT_NO_REGEXP
-    QList<QRegExp> nameFilters;
+    UiNameFilterMatcher nameFilters;
 #endif
+    // the tree being filtered on another thread, see refilter()
+    QSharedPointer<UiFileSystemRefilter> refilterJob;
+    // changes whenever nodes are added or removed or change what the filters see
+    int nodesGeneration;
     // ### Qt 5: resolvedSymLinks goes away
     QHash<QString, QString> resolvedSymLinks;
 
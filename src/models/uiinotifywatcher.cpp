@@ -0,0 +1,213 @@
+/****************************************************************************
+**
+** Copyright (C) 2012 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: http://www.qt-project.org/
+**
+** This file is part of the QtGui module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** GNU Lesser General Public License Usage
+** This file may be used under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation and
+** appearing in the file LICENSE.LGPL included in the packaging of this
+** file. Please review the following information to ensure the GNU Lesser
+** General Public License version 2.1 requirements will be met:
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Nokia gives you certain additional
+** rights. These rights are described in the Nokia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU General
+** Public License version 3.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this
+** file. Please review the following information to ensure the GNU General
+** Public License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** Other Usage
+** Alternatively, this file may be used in accordance with the terms and
+** conditions contained in a signed written agreement between you and Nokia.
+**
+**
+**
+**
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "uiinotifywatcher_p.h"
+
+#ifdef UI_INOTIFY_WATCHER
+
+#include <qfile.h>
+#include <qset.h>
+#include <qvarlengtharray.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+QT_BEGIN_NAMESPACE_UIHELPERS
+
+static const uint watchedEvents = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB
+                                  | IN_MOVED_FROM | IN_MOVED_TO
+                                  | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+UiInotifyWatcher::UiInotifyWatcher(QObject *parent)
+    : QObject(parent), inotifyFd(-1), notifier(0)
+{
+    inotifyFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd == -1)
+        return;
+    notifier = new QSocketNotifier(inotifyFd, QSocketNotifier::Read, this);
+    connect(notifier, SIGNAL(activated(int)), this, SLOT(readEvents()));
+}
+
+UiInotifyWatcher::~UiInotifyWatcher()
+{
+    if (inotifyFd != -1)
+        ::close(inotifyFd); // drops all watches
+}
+
+/*
+    Starts watching the directory \a path. Returns false if inotify isn't
+    available or the directory can't be watched, e.g. because the user's
+    limit of watches is reached.
+*/
+bool UiInotifyWatcher::addPath(const QString &path)
+{
+    if (inotifyFd == -1)
+        return false;
+    QMutexLocker locker(&mutex);
+    if (watchForPath.contains(path))
+        return true;
+    const int wd = ::inotify_add_watch(inotifyFd, QFile::encodeName(path).constData(), watchedEvents);
+    if (wd == -1)
+        return false;
+    // a directory reached through another path, e.g. a symbolic link, gets the same watch
+    pathsForWatch[wd].append(path);
+    watchForPath.insert(path, wd);
+    return true;
+}
+
+void UiInotifyWatcher::removePath(const QString &path)
+{
+    QMutexLocker locker(&mutex);
+    const int wd = watchForPath.take(path);
+    if (wd <= 0)
+        return;
+    QHash<int, QStringList>::iterator it = pathsForWatch.find(wd);
+    if (it == pathsForWatch.end())
+        return;
+    it->removeOne(path);
+    if (it->isEmpty()) {
+        pathsForWatch.erase(it);
+        ::inotify_rm_watch(inotifyFd, wd);
+    }
+}
+
+void UiInotifyWatcher::removePaths(const QStringList &paths)
+{
+    foreach (const QString &path, paths)
+        removePath(path);
+}
+
+QStringList UiInotifyWatcher::directories() const
+{
+    QMutexLocker locker(&mutex);
+    return watchForPath.keys();
+}
+
+/*
+    Reads what is pending on the inotify descriptor, and emits one signal per
+    directory and kind of change, so that a burst of events, e.g. from
+    unpacking an archive, costs the receiver little.
+*/
+void UiInotifyWatcher::readEvents()
+{
+    int available = 0;
+    if (::ioctl(inotifyFd, FIONREAD, &available) == -1 || available <= 0)
+        available = 4096;
+    QVarLengthArray<char, 4096> buffer(available);
+    const ssize_t length = ::read(inotifyFd, buffer.data(), available);
+    if (length <= 0)
+        return;
+
+    // directories in the order they were first touched, with what changed
+    // in them; a later event for an entry overrides an earlier one
+    QStringList directoryOrder;
+    QHash<QString, QSet<QString> > changed;
+    QHash<QString, QSet<QString> > removed;
+    QSet<QString> relist;
+    bool overflow = false;
+
+    QMutexLocker locker(&mutex);
+    for (ssize_t offset = 0; offset < length; ) {
+        const inotify_event *event = reinterpret_cast<const inotify_event *>(buffer.constData() + offset);
+        offset += sizeof(inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            overflow = true;
+            continue;
+        }
+        const QStringList directories = pathsForWatch.value(event->wd);
+        if (directories.isEmpty())
+            continue;
+        if (event->mask & IN_IGNORED) {
+            // the directory is gone, or the watch was removed
+            pathsForWatch.remove(event->wd);
+            foreach (const QString &directory, directories)
+                watchForPath.remove(directory);
+            continue;
+        }
+        if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+            foreach (const QString &directory, directories)
+                relist.insert(directory);
+            continue;
+        }
+        if (!event->len)
+            continue; // about the directory itself, e.g. its attributes
+
+        const QString fileName = QFile::decodeName(event->name);
+        foreach (const QString &directory, directories) {
+            if (!changed.contains(directory) && !removed.contains(directory))
+                directoryOrder.append(directory);
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                changed[directory].remove(fileName);
+                removed[directory].insert(fileName);
+            } else {
+                removed[directory].remove(fileName);
+                changed[directory].insert(fileName);
+            }
+        }
+    }
+    if (overflow) {
+        // events were lost, only a new listing can tell what changed
+        foreach (const QString &directory, watchForPath.keys())
+            relist.insert(directory);
+    }
+    locker.unlock();
+
+    foreach (const QString &directory, directoryOrder) {
+        if (relist.contains(directory))
+            continue;
+        const QSet<QString> removedFiles = removed.value(directory);
+        if (!removedFiles.isEmpty())
+            emit filesRemoved(directory, removedFiles.toList());
+        const QSet<QString> changedFiles = changed.value(directory);
+        if (!changedFiles.isEmpty())
+            emit filesChanged(directory, changedFiles.toList());
+    }
+    foreach (const QString &directory, relist)
+        emit directoryChanged(directory);
+}
+
+QT_END_NAMESPACE_UIHELPERS
+
+#endif // UI_INOTIFY_WATCHER
@@ -0,0 +1,117 @@
+/****************************************************************************
+**
+** Copyright (C) 2012 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: http://www.qt-project.org/
+**
+** This file is part of the QtGui module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** GNU Lesser General Public License Usage
+** This file may be used under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation and
+** appearing in the file LICENSE.LGPL included in the packaging of this
+** file. Please review the following information to ensure the GNU Lesser
+** General Public License version 2.1 requirements will be met:
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Nokia gives you certain additional
+** rights. These rights are described in the Nokia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU General
+** Public License version 3.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this
+** file. Please review the following information to ensure the GNU General
+** Public License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** Other Usage
+** Alternatively, this file may be used in accordance with the terms and
+** conditions contained in a signed written agreement between you and Nokia.
+**
+**
+**
+**
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef UIINOTIFYWATCHER_P_H
+#define UIINOTIFYWATCHER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+#include "uihelpersglobal.h"
+#include <qobject.h>
+#include <qhash.h>
+#include <qmutex.h>
+#include <qstringlist.h>
+#include <qsocketnotifier.h>
+
+#if defined(Q_OS_LINUX) && !defined(QT_NO_FILESYSTEMWATCHER)
+#  define UI_INOTIFY_WATCHER
+#endif
+
+QT_BEGIN_NAMESPACE_UIHELPERS
+
+#ifdef UI_INOTIFY_WATCHER
+
+/*
+    Watches directories with inotify and tells which entries changed, rather
+    than only that a directory did, as QFileSystemWatcher does. Paths may be
+    added and removed from any thread; the signals are emitted in the thread
+    the watcher lives in.
+*/
+class UiInotifyWatcher : public QObject
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    // entries created, modified or moved into the directory
+    void filesChanged(const QString &directory, const QStringList &files);
+    // entries deleted or moved out of the directory
+    void filesRemoved(const QString &directory, const QStringList &files);
+    // the directory itself changed in a way that needs a new listing, e.g.
+    // it was removed, or events were lost because the kernel queue overflowed
+    void directoryChanged(const QString &path);
+
+public:
+    explicit UiInotifyWatcher(QObject *parent = 0);
+    ~UiInotifyWatcher();
+
+    bool isValid() const { return inotifyFd != -1; }
+
+    bool addPath(const QString &path);
+    void removePath(const QString &path);
+    void removePaths(const QStringList &paths);
+    QStringList directories() const;
+
+private Q_SLOTS:
+    void readEvents();
+
+private:
+    int inotifyFd;
+    QSocketNotifier *notifier;
+    mutable QMutex mutex;
+    // a directory reached through several paths, e.g. symbolic links, has one
+    // watch for all of them, removed with the last one
+    QHash<int, QStringList> pathsForWatch;
+    QHash<QString, int> watchForPath;
+};
+
+#endif // UI_INOTIFY_WATCHER
+
+QT_END_NAMESPACE_UIHELPERS
+
+#endif // UIINOTIFYWATCHER_P_H
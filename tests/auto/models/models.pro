@@ -2,4 +2,5 @@ TEMPLATE=subdirs
 SUBDIRS=\
    qfilesystemmodel \
    qstandarditemmodel \
+   uicompletionmodel \
    uitextfilemodel
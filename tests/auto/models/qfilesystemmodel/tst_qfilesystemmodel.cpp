@@ -79,15 +79,22 @@ private slots:
     void rootPath();
     void naturalCompare_data();
     void naturalCompare();
+    void naturalSortKey_data();
+    void naturalSortKey();
+    void naturalSortTablePerLocale();
     void readOnly();
 
     void rowCount();
+    void detailsOnDemand();
+    void renameWithoutDetails();
+    void permissionFilterWithoutDetails();
 
     void rowsInserted_data();
     void rowsInserted();
 
     void rowsRemoved_data();
     void rowsRemoved();
+    void symLinkedDirectory();
 
     void dataChanged_data();
     void dataChanged();
@@ -96,12 +103,20 @@ private slots:
     void filters();
 
     void nameFilters();
+    void refilterLargeDirectory();
+    void nameFilterMatcher_data();
+    void nameFilterMatcher();
 
     void setData_data();
     void setData();
+    void renameKeepsOrder();
 
     void sort_data();
     void sort();
+    void insertIntoSortedDirectory_data();
+    void insertIntoSortedDirectory();
+    void sortLargeTree();
+    void detailsRequestedOnce();
 
     void mkdir();
 
@@ -300,6 +315,57 @@ void tst_UiFileSystemModel::naturalCompare()
 #endif
 }
 
+void tst_UiFileSystemModel::naturalSortKey_data()
+{
+    QTest::addColumn<QString>("s1");
+    QTest::addColumn<QString>("s2");
+
+    // s1 sorts before s2; numbers sort before any other character
+    QTest::newRow("digit before dash") << "a1" << "a-1";
+    QTest::newRow("digit before dot") << "a1" << "a.txt";
+    QTest::newRow("digit before underscore") << "1" << "_";
+    QTest::newRow("digit before letter") << "9" << "a";
+    QTest::newRow("numbers by value") << "file2.txt" << "file10.txt";
+    QTest::newRow("spaces skipped") << "photo9" << "photo 10";
+    QTest::newRow("case ignored") << "abc" << "ABD";
+    // equal keys, only the names tell them apart
+    QTest::newRow("leading zeros") << "file02" << "file2";
+    // the digits beyond what a key holds are skipped, not misread
+    QTest::newRow("long number") << QString(300, QLatin1Char('1')) << QString(300, QLatin1Char('1')) + "a";
+}
+
+void tst_UiFileSystemModel::naturalSortKey()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(QString, s1);
+    QFETCH(QString, s2);
+
+    const QByteArray key1 = UiFileSystemModelPrivate::naturalSortKey(s1);
+    const QByteArray key2 = UiFileSystemModelPrivate::naturalSortKey(s2);
+    QVERIFY(UiFileSystemModelPrivate::compareNaturalSortKeys(key1, key2) <= 0);
+    QVERIFY(UiFileSystemModelPrivate::compareNaturalSortKeys(key2, key1) >= 0);
+    QCOMPARE(UiFileSystemModelPrivate::naturalCompare(s1, s2, Qt::CaseInsensitive), -1);
+    QCOMPARE(UiFileSystemModelPrivate::naturalCompare(s2, s1, Qt::CaseInsensitive), 1);
+#endif
+}
+
+void tst_UiFileSystemModel::naturalSortTablePerLocale()
+{
+#ifdef QT_BUILD_INTERNAL
+    const QLocale oldLocale;
+    QLocale::setDefault(QLocale::c());
+    const UiNaturalSortTable *cTable = UiFileSystemModelPrivate::naturalSortTable();
+    QCOMPARE(UiFileSystemModelPrivate::naturalSortTable(), cTable);
+    QLocale::setDefault(QLocale(QLocale::German, QLocale::Germany));
+    // a new default locale gets a table of its own, the old one stays valid
+    const UiNaturalSortTable *germanTable = UiFileSystemModelPrivate::naturalSortTable();
+    QVERIFY(germanTable != cTable);
+    const QByteArray key = UiFileSystemModelPrivate::naturalSortKey("a-1", cTable);
+    QCOMPARE(UiFileSystemModelPrivate::compareNaturalSortKeys(key, key, cTable), 0);
+    QLocale::setDefault(oldLocale);
+#endif
+}
+
 void tst_UiFileSystemModel::readOnly()
 {
     QCOMPARE(model->isReadOnly(), true);
@@ -386,6 +452,55 @@ void tst_UiFileSystemModel::rowCount()
     QVERIFY(spy3.count() > 0);
 }
 
+void tst_UiFileSystemModel::detailsOnDemand()
+{
+    QString tmp = flatDirTestPath;
+    QVERIFY(createFiles(tmp, QStringList() << "a"));
+
+    model->setDetailsOnDemand(true);
+    QVERIFY(model->detailsOnDemand());
+
+    QModelIndex root = model->setRootPath(tmp);
+    QTRY_COMPARE(model->rowCount(root), 1);
+
+    QModelIndex idx = model->index(0, 1, root);
+    QVERIFY(idx.isValid());
+    model->data(idx, Qt::DisplayRole);
+    QTRY_COMPARE(model->size(idx), QFileInfo(tmp + QLatin1String("/a")).size());
+}
+
+void tst_UiFileSystemModel::renameWithoutDetails()
+{
+    QString tmp = flatDirTestPath;
+    QVERIFY(createFiles(tmp, QStringList() << "a"));
+
+    model->setDetailsOnDemand(true);
+    model->setReadOnly(false);
+    QModelIndex root = model->setRootPath(tmp);
+    QTRY_COMPARE(model->rowCount(root), 1);
+
+    // only the name column is ever shown
+    QModelIndex idx = model->index(0, 0, root);
+    QVERIFY(model->flags(idx) & Qt::ItemIsEditable);
+    QVERIFY(model->setData(idx, QString("b")));
+    QVERIFY(QFile::exists(tmp + QLatin1String("/b")));
+    QTRY_COMPARE(model->index(0, 0, root).data().toString(), QString("b"));
+}
+
+void tst_UiFileSystemModel::permissionFilterWithoutDetails()
+{
+    QString tmp = flatDirTestPath;
+    QVERIFY(createFiles(tmp, QStringList() << "a" << "b"));
+
+    model->setDetailsOnDemand(true);
+    QModelIndex root = model->setRootPath(tmp);
+    QTRY_COMPARE(model->rowCount(root), 2);
+
+    // the rows listed so far get the permissions the filter needs
+    model->setFilter(QDir::Files | QDir::Readable);
+    QTRY_COMPARE(model->rowCount(root), 2);
+}
+
 void tst_UiFileSystemModel::rowsInserted_data()
 {
     QTest::addColumn<int>("count");
@@ -451,6 +566,40 @@ void tst_UiFileSystemModel::rowsRemoved_data()
     rowsInserted_data();
 }
 
+void tst_UiFileSystemModel::symLinkedDirectory()
+{
+#if !defined(Q_OS_UNIX)
+    QSKIP("Test requires symbolic links to directories");
+#else
+    // the same directory watched through two paths
+    QString tmp = flatDirTestPath;
+    QVERIFY(createFiles(tmp, QStringList(), 0, QStringList("target")));
+    QVERIFY(QFile::link(tmp + "/target", tmp + "/link"));
+    QModelIndex root = model->setRootPath(tmp);
+    QTRY_COMPARE(model->rowCount(root), 2);
+
+    QModelIndex target = model->index(tmp + "/target");
+    QModelIndex link = model->index(tmp + "/link");
+    model->fetchMore(target);
+    model->fetchMore(link);
+    QTest::qWait(WAITTIME);
+
+    QFile file(tmp + "/target/a");
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.close();
+    QTRY_COMPARE(model->rowCount(target), 1);
+    QTRY_COMPARE(model->rowCount(link), 1);
+
+    // no longer watching one of the paths leaves the other one watched;
+    // rmdir() stops watching the link before failing to remove it
+    QVERIFY(!model->rmdir(link));
+    QVERIFY(QFile::remove(tmp + "/link"));
+    QVERIFY(QFile::remove(tmp + "/target/a"));
+    QTRY_COMPARE(model->rowCount(target), 0);
+    QTRY_COMPARE(model->rowCount(root), 1);
+#endif
+}
+
 void tst_UiFileSystemModel::rowsRemoved()
 {
 #if defined(Q_OS_WINCE)
@@ -681,6 +830,73 @@ void tst_UiFileSystemModel::nameFilters()
     model->setNameFilters(filters);
     QTRY_COMPARE(model->rowCount(root), 2);
 }
+
+void tst_UiFileSystemModel::refilterLargeDirectory()
+{
+    // enough files for the filters to be applied on another thread
+    QStringList files;
+    for (int i = 0; i < 2500; ++i)
+        files << QString("file%1.txt").arg(i) << QString("file%1.dat").arg(i);
+    QString tmp = flatDirTestPath;
+    QVERIFY(createFiles(tmp, files));
+    model->setNameFilterDisables(false);
+    QModelIndex root = model->setRootPath(tmp);
+    QTRY_COMPARE(model->rowCount(root), 5000);
+    QTest::qWait(WAITTIME);
+
+    QPersistentModelIndex kept = model->index(tmp + "/file7.txt");
+    QVERIFY(kept.isValid());
+
+    model->setNameFilters(QStringList("*.txt"));
+    QTRY_COMPARE(model->rowCount(root), 2500);
+    for (int i = 0; i < model->rowCount(root); ++i)
+        QVERIFY(model->index(i, 0, root).data().toString().endsWith(".txt"));
+    QCOMPARE(kept.data().toString(), QString("file7.txt"));
+    QCOMPARE(model->index(0, 0, root).data().toString(), QString("file0.txt"));
+    QCOMPARE(model->index(2499, 0, root).data().toString(), QString("file2499.txt"));
+
+    model->setNameFilters(QStringList());
+    QTRY_COMPARE(model->rowCount(root), 5000);
+    QCOMPARE(kept.data().toString(), QString("file7.txt"));
+    QCOMPARE(model->index(0, 0, root).data().toString(), QString("file0.dat"));
+}
+
+void tst_UiFileSystemModel::nameFilterMatcher_data()
+{
+    QTest::addColumn<QStringList>("patterns");
+    QTest::addColumn<int>("caseSensitive");
+
+    QTest::newRow("exact") << (QStringList() << "Makefile" << "a") << int(Qt::CaseInsensitive);
+    QTest::newRow("suffix") << (QStringList() << "*.cpp" << "*.h") << int(Qt::CaseInsensitive);
+    QTest::newRow("suffix cs") << (QStringList() << "*.cpp" << "*.H") << int(Qt::CaseSensitive);
+    QTest::newRow("prefix") << (QStringList() << "README*" << "a*") << int(Qt::CaseInsensitive);
+    QTest::newRow("all") << (QStringList() << "*") << int(Qt::CaseInsensitive);
+    QTest::newRow("others") << (QStringList() << "*.[ch]" << "file?.txt" << "*test*") << int(Qt::CaseInsensitive);
+    QTest::newRow("mixed") << (QStringList() << "*.cpp" << "README*" << "x.[!c]" << "a") << int(Qt::CaseSensitive);
+}
+
+void tst_UiFileSystemModel::nameFilterMatcher()
+{
+#if defined(QT_BUILD_INTERNAL) && !defined(QT_NO_REGEXP)
+    QFETCH(QStringList, patterns);
+    QFETCH(int, caseSensitive);
+    const Qt::CaseSensitivity cs = Qt::CaseSensitivity(caseSensitive);
+
+    UiNameFilterMatcher matcher;
+    matcher.setPatterns(patterns, cs);
+    QCOMPARE(matcher.patterns(), patterns);
+
+    const QStringList names = QStringList() << "a" << "A" << "b" << "Makefile" << "makefile"
+        << "main.cpp" << "MAIN.CPP" << "main.h" << "main.H" << "main.c" << "x.c" << "x.d"
+        << "README" << "readme.txt" << "file1.txt" << "file12.txt" << "mytest.sh" << ".cpp" << "";
+    foreach (const QString &name, names) {
+        bool expected = false;
+        foreach (const QString &pattern, patterns)
+            expected = expected || QRegExp(pattern, cs, QRegExp::Wildcard).exactMatch(name);
+        QVERIFY2(matcher.matches(name) == expected, qPrintable(name));
+    }
+#endif
+}
 void tst_UiFileSystemModel::setData_data()
 {
     QTest::addColumn<QStringList>("files");
@@ -729,6 +945,29 @@ void tst_UiFileSystemModel::setData()
     QTRY_COMPARE(model->rowCount(root), files.count());
 }
 
+void tst_UiFileSystemModel::renameKeepsOrder()
+{
+    QString tmp = flatDirTestPath;
+    QVERIFY(createFiles(tmp, QStringList() << "b" << "d" << "f"));
+    QModelIndex root = model->setRootPath(tmp);
+    QTRY_COMPARE(model->rowCount(root), 3);
+    QTest::qWait(WAITTIME);
+
+    model->setReadOnly(false);
+    QVERIFY(model->setData(model->index(tmp + "/b"), QString("z")));
+    QTRY_COMPARE(model->index(2, 0, root).data().toString(), QString("z"));
+
+    // new rows are merged into the ones sorted again after the rename
+    QFile file(tmp + "/e");
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.close();
+    QTRY_COMPARE(model->rowCount(root), 4);
+    QStringList names;
+    for (int i = 0; i < model->rowCount(root); ++i)
+        names << model->index(i, 0, root).data().toString();
+    QCOMPARE(names, QStringList() << "d" << "e" << "f" << "z");
+}
+
 class MyFriendFileSystemModel : public UiFileSystemModel
 {
     friend class tst_UiFileSystemModel;
@@ -847,6 +1086,162 @@ void tst_UiFileSystemModel::sort()
 
 }
 
+void tst_UiFileSystemModel::insertIntoSortedDirectory_data()
+{
+    QTest::addColumn<int>("order");
+    QTest::addColumn<int>("runs");
+    QTest::newRow("ascending, row inserts") << int(Qt::AscendingOrder) << 5;
+    QTest::newRow("descending, row inserts") << int(Qt::DescendingOrder) << 5;
+    QTest::newRow("ascending, layout change") << int(Qt::AscendingOrder) << 40;
+    QTest::newRow("descending, layout change") << int(Qt::DescendingOrder) << 40;
+}
+
+void tst_UiFileSystemModel::insertIntoSortedDirectory()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(int, order);
+    QFETCH(int, runs);
+
+    // f000, f002, ... and two new rows after each but the last of them
+    QStringList files;
+    QStringList newFiles;
+    for (int i = 0; i <= runs; ++i)
+        files << QString("f%1").arg(2 * i, 3, 10, QLatin1Char('0'));
+    for (int i = 0; i < runs; ++i) {
+        const QString name = QString("f%1").arg(2 * i + 1, 3, 10, QLatin1Char('0'));
+        newFiles << name + 'a' << name + 'b';
+    }
+    QString tmp = flatDirTestPath;
+    QVERIFY(createFiles(tmp, files));
+
+    MyFriendFileSystemModel *myModel = new MyFriendFileSystemModel();
+    UiFileSystemModelPrivate *d = myModel->d_func();
+    QModelIndex root = myModel->setRootPath(tmp);
+    myModel->sort(0, Qt::SortOrder(order));
+    QTRY_COMPARE(myModel->rowCount(root), files.count());
+    QTRY_VERIFY(!d->forceSort);
+    QTest::qWait(WAITTIME);
+
+    // as the gatherer reports them, in no particular order
+    QList<QPair<QString, UiExtendedInformation> > updates;
+    for (int i = newFiles.count() - 1; i >= 0; --i) {
+        UiExtendedInformation info;
+        info.setStat(UiExtendedInformation::File, 1024, 0, QFile::ReadUser | QFile::WriteUser, false, false);
+        updates.append(qMakePair(newFiles.at(i), info));
+    }
+    QSignalSpy inserted(myModel, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QSignalSpy layout(myModel, SIGNAL(layoutChanged()));
+    d->_q_fileSystemChanged(tmp, updates);
+
+    const int existing = files.count();
+    if (runs <= 32) {
+        // one insert per run, from the last one back
+        QCOMPARE(layout.count(), 0);
+        QCOMPARE(inserted.count(), runs);
+        for (int i = 0; i < runs; ++i) {
+            const int position = runs - i;
+            const int row = order == Qt::AscendingOrder ? position : existing + 2 * i - position;
+            QCOMPARE(inserted.at(i).at(1).toInt(), row);
+            QCOMPARE(inserted.at(i).at(2).toInt(), row + 1);
+        }
+    } else {
+        // appended, then moved into place by a layout change
+        QCOMPARE(inserted.count(), 1);
+        QCOMPARE(inserted.at(0).at(1).toInt(), existing);
+        QCOMPARE(inserted.at(0).at(2).toInt(), existing + newFiles.count() - 1);
+        QCOMPARE(layout.count(), 1);
+    }
+
+    QStringList expected = files + newFiles;
+    qSort(expected.begin(), expected.end());
+    if (order == Qt::DescendingOrder) {
+        for (int i = 0; i < expected.count() / 2; ++i)
+            expected.swap(i, expected.count() - 1 - i);
+    }
+    QStringList actual;
+    for (int i = 0; i < myModel->rowCount(root); ++i)
+        actual << myModel->index(i, 0, root).data().toString();
+    QCOMPARE(actual, expected);
+
+    delete myModel;
+#endif
+}
+
+void tst_UiFileSystemModel::sortLargeTree()
+{
+    // more entries in all than are sorted on the GUI thread alone
+    const int directoryCount = 4;
+    const int fileCount = 1100;
+    QString tmp = flatDirTestPath;
+    QStringList directories;
+    for (int i = 0; i < directoryCount; ++i)
+        directories << QString("d%1").arg(i);
+    QVERIFY(createFiles(tmp, QStringList(), 0, directories));
+    for (int i = 0; i < directoryCount; ++i) {
+        for (int j = 0; j < fileCount; ++j) {
+            // sizes in another order than the names
+            QFile file(tmp + '/' + directories.at(i) + QString("/f%1").arg(j));
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            QVERIFY(file.resize((j * 7919 + i) % 1000));
+        }
+    }
+
+    QModelIndex root = model->setRootPath(tmp);
+    QTRY_COMPARE(model->rowCount(root), directoryCount);
+    QList<QPersistentModelIndex> parents;
+    for (int i = 0; i < directoryCount; ++i) {
+        parents << QPersistentModelIndex(model->index(tmp + '/' + directories.at(i)));
+        model->fetchMore(parents.last());
+    }
+    for (int i = 0; i < directoryCount; ++i)
+        QTRY_COMPARE(model->rowCount(parents.at(i)), fileCount);
+    QTest::qWait(WAITTIME);
+
+    model->sort(1, Qt::AscendingOrder);
+    for (int i = 0; i < directoryCount; ++i) {
+        for (int j = 1; j < fileCount; ++j) {
+            QFileInfo previous = model->fileInfo(model->index(j - 1, 0, parents.at(i)));
+            QFileInfo current = model->fileInfo(model->index(j, 0, parents.at(i)));
+            QVERIFY(previous.size() <= current.size());
+        }
+    }
+
+    model->sort(0, Qt::AscendingOrder);
+    for (int i = 0; i < directoryCount; ++i) {
+        for (int j = 0; j < fileCount; ++j)
+            QCOMPARE(model->index(j, 0, parents.at(i)).data().toString(), QString("f%1").arg(j));
+    }
+
+    for (int i = 0; i < directoryCount; ++i)
+        QVERIFY(QDir(tmp + '/' + directories.at(i)).removeRecursively());
+}
+
+void tst_UiFileSystemModel::detailsRequestedOnce()
+{
+#ifdef QT_BUILD_INTERNAL
+    QString tmp = flatDirTestPath;
+    QVERIFY(createFiles(tmp, QStringList() << "a"));
+
+    QScopedPointer<MyFriendFileSystemModel> myModel(new MyFriendFileSystemModel);
+    myModel->setDetailsOnDemand(true);
+    QModelIndex root = myModel->setRootPath(tmp);
+    QTRY_COMPARE(myModel->rowCount(root), 1);
+    QModelIndex idx = myModel->index(0, 1, root);
+    if (myModel->d_func()->node(idx)->hasDetails())
+        QSKIP("Listings always come with details here");
+
+    // painting the row again before the details came doesn't ask again
+    for (int i = 0; i < 3; ++i) {
+        myModel->data(idx, Qt::DisplayRole);
+        myModel->data(idx.sibling(0, 3), Qt::DisplayRole);
+    }
+    QCOMPARE(myModel->d_func()->toFetch.count(), 1);
+    QTRY_COMPARE(myModel->size(idx), QFileInfo(tmp + QLatin1String("/a")).size());
+    QVERIFY(!(myModel->d_func()->node(idx)->attributes
+              & UiFileSystemModelPrivate::DetailsRequestedAttribute));
+#endif
+}
+
 void tst_UiFileSystemModel::mkdir()
 {
     QString tmp = QDir::tempPath();
@@ -0,0 +1,386 @@
+/****************************************************************************
+**
+** Copyright (C) 2012 Instituto Nokia de Tecnologia (INdT)
+** Contact: http://www.qt-project.org/
+**
+** This file is part of the UiHelpers playground module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** GNU Lesser General Public License Usage
+** This file may be used under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation and
+** appearing in the file LICENSE.LGPL included in the packaging of this
+** file. Please review the following information to ensure the GNU Lesser
+** General Public License version 2.1 requirements will be met:
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Nokia gives you certain additional
+** rights. These rights are described in the Nokia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU General
+** Public License version 3.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this
+** file. Please review the following information to ensure the GNU General
+** Public License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** Other Usage
+** Alternatively, this file may be used in accordance with the terms and
+** conditions contained in a signed written agreement between you and Nokia.
+**
+**
+**
+**
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QtCore/QStringListModel>
+#include <QtCore/QTemporaryFile>
+#include <QtTest/QtTest>
+#include <UiHelpers/UiCompletionModel>
+#include <UiHelpers/UiStandardItemModel>
+
+class tst_UiCompletionModel: public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void init();
+
+private:
+    QStringListModel source;
+
+private slots:
+    void prefixMatch_data();
+    void prefixMatch();
+    void longPrefix();
+    void sortedModel_data();
+    void sortedModel();
+    void pathCompletion();
+    void ranking();
+    void rankingLazyMatches();
+    void incrementalUpdates();
+    void sharedIndex();
+    void maxResults();
+    void deferredFilter();
+};
+
+static QStringList completions(const UiHelpers::UiCompletionModel &model)
+{
+    QStringList result;
+    for (int i = 0; i < model.rowCount(); ++i)
+        result << model.index(i, 0).data().toString();
+    return result;
+}
+
+void tst_UiCompletionModel::init()
+{
+    QStringList words;
+    words << "Brazil" << "bravo" << "Britain" << "Belgium" << "brazil nut"
+          << "Chile" << "china" << "Kenya" << "kiwi" << "" << "B";
+    // enough rows to cross several SIMD blocks between matches
+    for (int i = 0; i < 40; ++i)
+        words << QString("zz%1").arg(i);
+    words << "Brazzaville";
+    source.setStringList(words);
+}
+
+void tst_UiCompletionModel::prefixMatch_data()
+{
+    QTest::addColumn<QString>("prefix");
+    QTest::addColumn<int>("caseSensitivity");
+    QTest::addColumn<QStringList>("expected");
+
+    QTest::newRow("sensitive") << "Bra" << int(Qt::CaseSensitive)
+                               << (QStringList() << "Brazil" << "Brazzaville");
+    QTest::newRow("insensitive") << "bra" << int(Qt::CaseInsensitive)
+                                 << (QStringList() << "Brazil" << "bravo" << "brazil nut" << "Brazzaville");
+    QTest::newRow("single char") << "B" << int(Qt::CaseSensitive)
+                                 << (QStringList() << "Brazil" << "Britain" << "Belgium" << "B" << "Brazzaville");
+    QTest::newRow("kelvin") << "k" << int(Qt::CaseInsensitive)
+                            << (QStringList() << "Kenya" << "kiwi");
+    QTest::newRow("no match") << "x" << int(Qt::CaseInsensitive) << QStringList();
+}
+
+void tst_UiCompletionModel::prefixMatch()
+{
+    QFETCH(QString, prefix);
+    QFETCH(int, caseSensitivity);
+    QFETCH(QStringList, expected);
+
+    UiHelpers::UiCompletionModel model;
+    model.setSourceModel(&source);
+    model.setCaseSensitivity(Qt::CaseSensitivity(caseSensitivity));
+    model.setCompletionPrefix(prefix);
+    QCOMPARE(completions(model), expected);
+}
+
+void tst_UiCompletionModel::longPrefix()
+{
+    UiHelpers::UiCompletionModel model;
+    model.setSourceModel(&source);
+    model.setCompletionPrefix("brazil nu");
+    QCOMPARE(completions(model), QStringList());
+
+    model.setCaseSensitivity(Qt::CaseInsensitive);
+    model.setCompletionPrefix("BRAZIL NU");
+    QCOMPARE(completions(model), QStringList() << "brazil nut");
+}
+
+void tst_UiCompletionModel::sortedModel_data()
+{
+    QTest::addColumn<QString>("prefix");
+    QTest::addColumn<int>("caseSensitivity");
+    QTest::addColumn<QStringList>("expected");
+
+    QTest::newRow("insensitive") << "ap" << int(Qt::CaseInsensitive)
+                                 << (QStringList() << "Apple" << "apricot" << "APT");
+    QTest::newRow("sensitive lower") << "a" << int(Qt::CaseSensitive)
+                                     << (QStringList() << "alpha" << "apricot");
+    QTest::newRow("sensitive upper") << "AP" << int(Qt::CaseSensitive)
+                                     << (QStringList() << "APT");
+    QTest::newRow("sensitive none") << "bA" << int(Qt::CaseSensitive) << QStringList();
+}
+
+void tst_UiCompletionModel::sortedModel()
+{
+    QFETCH(QString, prefix);
+    QFETCH(int, caseSensitivity);
+    QFETCH(QStringList, expected);
+
+    QStringListModel sorted(QStringList() << "alpha" << "Apple" << "apricot" << "APT"
+                                          << "Banana" << "berry");
+    UiHelpers::UiCompletionModel model;
+    model.setSourceModel(&sorted);
+    model.setModelSorting(UiHelpers::UiCompletionModel::CaseInsensitivelySortedModel);
+    model.setCaseSensitivity(Qt::CaseSensitivity(caseSensitivity));
+    model.setCompletionPrefix(prefix);
+    QCOMPARE(completions(model), expected);
+}
+
+void tst_UiCompletionModel::pathCompletion()
+{
+    UiHelpers::UiStandardItemModel tree;
+    UiHelpers::UiStandardItem *usr = new UiHelpers::UiStandardItem("usr");
+    usr->appendRow(new UiHelpers::UiStandardItem("bin"));
+    usr->appendRow(new UiHelpers::UiStandardItem("lib"));
+    usr->appendRow(new UiHelpers::UiStandardItem("libexec"));
+    UiHelpers::UiStandardItem *var = new UiHelpers::UiStandardItem("var");
+    var->appendRow(new UiHelpers::UiStandardItem("lib"));
+    tree.appendRow(usr);
+    tree.appendRow(var);
+
+    UiHelpers::UiCompletionModel model;
+    model.setSourceModel(&tree);
+
+    // top level rows matching completionPrefix() come first
+    const QStringList history = QStringList() << "usr" << "var";
+    model.filter(QStringList() << "usr" << "li");
+    QCOMPARE(completions(model), history + (QStringList() << "lib" << "libexec"));
+    model.filter(QStringList() << "usr" << "b");
+    QCOMPARE(completions(model), history + (QStringList() << "bin"));
+    model.filter(QStringList() << "var" << "");
+    QCOMPARE(completions(model), history + (QStringList() << "lib"));
+
+    model.setCaseSensitivity(Qt::CaseInsensitive);
+    model.filter(QStringList() << "USR" << "LIBE");
+    QCOMPARE(completions(model), history + (QStringList() << "libexec"));
+}
+
+void tst_UiCompletionModel::ranking()
+{
+    UiHelpers::UiCompletionModel model;
+    model.setSourceModel(&source);
+    model.recordUsage("Britain");
+    model.recordUsage("Britain");
+    model.recordUsage("Belgium");
+    model.recordUsage("Chile");
+
+    model.setCompletionPrefix("B");
+    QCOMPARE(completions(model), QStringList() << "Brazil" << "Britain" << "Belgium" << "B" << "Brazzaville");
+
+    model.setRankingEnabled(true);
+    QCOMPARE(completions(model), QStringList() << "Britain" << "Belgium" << "Brazil" << "B" << "Brazzaville");
+
+    model.setRankedCount(1);
+    QCOMPARE(completions(model), QStringList() << "Britain" << "Brazil" << "Belgium" << "B" << "Brazzaville");
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QVERIFY(model.saveUsage(file.fileName()));
+
+    UiHelpers::UiCompletionModel restored;
+    restored.setSourceModel(&source);
+    restored.setRankingEnabled(true);
+    QVERIFY(restored.loadUsage(file.fileName()));
+    restored.setCompletionPrefix("B");
+    QCOMPARE(completions(restored), QStringList() << "Britain" << "Belgium" << "Brazil" << "B" << "Brazzaville");
+
+    restored.clearUsage();
+    QCOMPARE(completions(restored), QStringList() << "Brazil" << "Britain" << "Belgium" << "B" << "Brazzaville");
+
+    // a header claiming far more records than follow
+    QTemporaryFile truncated;
+    QVERIFY(truncated.open());
+    {
+        QDataStream out(&truncated);
+        out << quint32(0x55694355) << quint32(1) << quint32(0xffffffff);
+        out << QString("Britain") << quint32(2) << qint64(0);
+    }
+    truncated.close();
+    QVERIFY(!restored.loadUsage(truncated.fileName()));
+    QCOMPARE(completions(restored), QStringList() << "Brazil" << "Britain" << "Belgium" << "B" << "Brazzaville");
+}
+
+void tst_UiCompletionModel::rankingLazyMatches()
+{
+    QStringList words;
+    for (int i = 0; i < 1000; ++i)
+        words << QString("word%1").arg(i, 4, 10, QLatin1Char('0'));
+    QStringListModel many(words);
+
+    UiHelpers::UiCompletionModel model;
+    model.setSourceModel(&many);
+    model.setMaxResults(3);
+    model.setRankingEnabled(true);
+    model.recordUsage("word0999");
+    model.recordUsage("word0999");
+    model.recordUsage("word0500");
+    model.recordUsage("other");
+
+    // the used rows lie far beyond the few matches looked for
+    model.setCompletionPrefix("word");
+    QCOMPARE(completions(model), QStringList() << "word0999" << "word0500" << "word0000");
+    QCOMPARE(model.mapFromSource(many.index(0, 0)).row(), 2);
+    QCOMPARE(model.mapFromSource(many.index(999, 0)).row(), 0);
+    QVERIFY(!model.mapFromSource(many.index(1, 0)).isValid());
+
+    model.setCompletionPrefix("word09");
+    QCOMPARE(completions(model), QStringList() << "word0999" << "word0900" << "word0901");
+
+    model.setMaxResults(0);
+    QCOMPARE(model.completionCount(), 100);
+    QCOMPARE(model.index(99, 0).data().toString(), QString("word0998"));
+}
+
+void tst_UiCompletionModel::incrementalUpdates()
+{
+    UiHelpers::UiCompletionModel model;
+    model.setSourceModel(&source);
+    model.setCaseSensitivity(Qt::CaseInsensitive);
+    model.setCompletionPrefix("b");
+    QCOMPARE(model.rowCount(), 7);
+
+    QSignalSpy resetSpy(&model, SIGNAL(modelReset()));
+    QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    QSignalSpy insertedSpy(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QPersistentModelIndex britain = model.index(2, 0);
+    QCOMPARE(britain.data().toString(), QString("Britain"));
+
+    // b: Brazil bravo Britain Belgium "brazil nut" B Brazzaville -> br
+    model.setCompletionPrefix("br");
+    QCOMPARE(completions(model), QStringList() << "Brazil" << "bravo" << "Britain" << "brazil nut" << "Brazzaville");
+    QCOMPARE(resetSpy.count(), 0);
+    QCOMPARE(insertedSpy.count(), 0);
+    QCOMPARE(removedSpy.count(), 2);
+    QCOMPARE(removedSpy.at(0).at(1).toInt(), 5);
+    QCOMPARE(removedSpy.at(0).at(2).toInt(), 5);
+    QCOMPARE(removedSpy.at(1).at(1).toInt(), 3);
+    QCOMPARE(removedSpy.at(1).at(2).toInt(), 3);
+    QCOMPARE(britain.row(), 2);
+
+    removedSpy.clear();
+    model.setCompletionPrefix("b");
+    QCOMPARE(model.rowCount(), 7);
+    QCOMPARE(resetSpy.count(), 0);
+    QCOMPARE(removedSpy.count(), 0);
+    QCOMPARE(insertedSpy.count(), 2);
+    QCOMPARE(britain.row(), 2);
+
+    // neither narrower nor wider
+    model.setCompletionPrefix("c");
+    QCOMPARE(resetSpy.count(), 1);
+}
+
+void tst_UiCompletionModel::sharedIndex()
+{
+    UiHelpers::UiCompletionModel sensitive;
+    sensitive.setSourceModel(&source);
+    sensitive.setCompletionPrefix("Br");
+    UiHelpers::UiCompletionModel insensitive;
+    insensitive.setSourceModel(&source);
+    insensitive.setCaseSensitivity(Qt::CaseInsensitive);
+    insensitive.setCompletionPrefix("br");
+    QCOMPARE(completions(sensitive), QStringList() << "Brazil" << "Britain" << "Brazzaville");
+    QCOMPARE(completions(insensitive), QStringList() << "Brazil" << "bravo" << "Britain" << "brazil nut" << "Brazzaville");
+
+    // both models must drop the index built before the change
+    source.setData(source.index(0, 0), "Brunei");
+    QCOMPARE(completions(sensitive), QStringList() << "Brunei" << "Britain" << "Brazzaville");
+    QCOMPARE(completions(insensitive), QStringList() << "Brunei" << "bravo" << "Britain" << "brazil nut" << "Brazzaville");
+
+    UiHelpers::UiCompletionModel late;
+    late.setSourceModel(&source);
+    late.setCompletionPrefix("Bru");
+    QCOMPARE(completions(late), QStringList() << "Brunei");
+
+    source.setData(source.index(0, 0), "Brazil");
+    QCOMPARE(completions(late), QStringList());
+    QCOMPARE(completions(sensitive), QStringList() << "Brazil" << "Britain" << "Brazzaville");
+}
+
+void tst_UiCompletionModel::maxResults()
+{
+    UiHelpers::UiCompletionModel model;
+    model.setSourceModel(&source);
+    model.setMaxResults(3);
+    model.setCompletionPrefix("zz");
+    QCOMPARE(model.rowCount(), 3);
+    QCOMPARE(completions(model), QStringList() << "zz0" << "zz1" << "zz2");
+    QVERIFY(!model.index(3, 0).isValid());
+    QVERIFY(!model.mapFromSource(source.index(14, 0)).isValid());
+    QCOMPARE(model.completionCount(), 40);
+
+    model.setCompletionPrefix("zz3");
+    QCOMPARE(completions(model), QStringList() << "zz3" << "zz30" << "zz31");
+
+    model.setMaxResults(0);
+    QCOMPARE(model.rowCount(), 11);
+}
+
+// Filters only when flushed, like a model coalescing prefixes
+class DeferredCompletionModel : public UiHelpers::UiCompletionModel
+{
+public:
+    DeferredCompletionModel() : requests(0) { }
+    void flush() { UiHelpers::UiCompletionModel::filterPrefix(); }
+    int requests;
+
+protected:
+    void filterPrefix() { ++requests; }
+};
+
+void tst_UiCompletionModel::deferredFilter()
+{
+    DeferredCompletionModel model;
+    model.setSourceModel(&source);
+
+    // neither calls through the base class nor its slot bypass the hook
+    UiHelpers::UiCompletionModel *base = &model;
+    base->setCompletionPrefix("B");
+    QMetaObject::invokeMethod(base, "setCompletionPrefix", Q_ARG(QString, "Br"));
+    QCOMPARE(model.requests, 2);
+    QCOMPARE(base->completionPrefix(), QString("Br"));
+    QCOMPARE(base->property("completionPrefix").toString(), QString("Br"));
+
+    model.flush();
+    QCOMPARE(completions(model), QStringList() << "Brazil" << "Britain" << "Brazzaville");
+}
+
+QTEST_MAIN(tst_UiCompletionModel)
+#include "tst_uicompletionmodel.moc"
@@ -0,0 +1,6 @@
+CONFIG += testcase
+TARGET = tst_uicompletionmodel
+
+QT += testlib uihelpers core-private gui-private
+
+SOURCES  += tst_uicompletionmodel.cpp
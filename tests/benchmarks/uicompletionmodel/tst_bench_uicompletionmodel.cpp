@@ -0,0 +1,279 @@
+/****************************************************************************
+**
+** Copyright (C) 2012 Instituto Nokia de Tecnologia (INdT)
+** Contact: http://www.qt-project.org/
+**
+** This file is part of the UiHelpers playground module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** GNU Lesser General Public License Usage
+** This file may be used under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation and
+** appearing in the file LICENSE.LGPL included in the packaging of this
+** file. Please review the following information to ensure the GNU Lesser
+** General Public License version 2.1 requirements will be met:
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Nokia gives you certain additional
+** rights. These rights are described in the Nokia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU General
+** Public License version 3.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this
+** file. Please review the following information to ensure the GNU General
+** Public License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** Other Usage
+** Alternatively, this file may be used in accordance with the terms and
+** conditions contained in a signed written agreement between you and Nokia.
+**
+**
+**
+**
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QtCore/QFile>
+#include <QtCore/QStringListModel>
+#include <QtTest/QtTest>
+#include <UiHelpers/UiCompletionModel>
+#include <private/uicompletionmodel_p.h>
+
+QT_USE_NAMESPACE_UIHELPERS
+
+// Set to run the 10M entries rows, which need several GB of memory
+static const char hugeVariable[] = "UIHELPERS_BENCH_HUGE";
+
+class tst_bench_UiCompletionModel : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void typing_data();
+    void typing();
+    void coldTyping_data();
+    void coldTyping();
+    void cacheMisses_data();
+    void cacheMisses();
+    void memory_data();
+    void memory();
+    void realDictionary_data();
+    void realDictionary();
+
+private:
+    enum Measurement { Typing, ColdTyping, CacheMisses, Memory };
+
+    void addSyntheticRows();
+    void runSynthetic(Measurement measurement);
+    void run(const QStringList &words, const QString &target, bool sorted,
+             Qt::CaseSensitivity cs, Measurement measurement);
+};
+
+// Deterministic pseudo random words, about a quarter of them capitalized
+static QStringList dictionary(int size)
+{
+    static QHash<int, QStringList> generated;
+    if (generated.contains(size))
+        return generated.value(size);
+
+    QStringList words;
+    words.reserve(size);
+    quint32 seed = 0x2545f491;
+    for (int i = 0; i < size; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        const int length = 3 + (seed >> 24) % 10;
+        QString word(length, Qt::Uninitialized);
+        for (int j = 0; j < length; ++j) {
+            seed = seed * 1664525 + 1013904223;
+            word[j] = QLatin1Char('a' + (seed >> 16) % 26);
+        }
+        if ((seed >> 8) % 4 == 0)
+            word[0] = word.at(0).toUpper();
+        words.append(word);
+    }
+    generated.insert(size, words);
+    return words;
+}
+
+static bool caseInsensitiveLessThan(const QString &s1, const QString &s2)
+{
+    return QString::compare(s1, s2, Qt::CaseInsensitive) < 0;
+}
+
+// Types target one character at a time, then erases it again
+static QStringList keystrokes(const QString &target)
+{
+    QStringList prefixes;
+    for (int i = 1; i <= target.length(); ++i)
+        prefixes.append(target.left(i));
+    for (int i = target.length() - 1; i >= 0; --i)
+        prefixes.append(target.left(i));
+    return prefixes;
+}
+
+void tst_bench_UiCompletionModel::addSyntheticRows()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<bool>("sorted");
+    QTest::addColumn<int>("caseSensitivity");
+
+    const int sizes[] = { 10000, 1000000, 10000000 };
+    const char *sizeNames[] = { "10k", "1M", "10M" };
+    for (int i = 0; i < 3; ++i) {
+        for (int s = 0; s < 2; ++s) {
+            const bool sorted = s == 0;
+            for (int c = 0; c < 2; ++c) {
+                const Qt::CaseSensitivity cs = c == 0 ? Qt::CaseSensitive : Qt::CaseInsensitive;
+                const QByteArray name = QByteArray(sizeNames[i])
+                    + (sorted ? " sorted" : " shuffled")
+                    + (cs == Qt::CaseSensitive ? " sensitive" : " insensitive");
+                QTest::newRow(name.constData()) << sizes[i] << sorted << int(cs);
+            }
+        }
+    }
+}
+
+void tst_bench_UiCompletionModel::runSynthetic(Measurement measurement)
+{
+    QFETCH(int, size);
+    QFETCH(bool, sorted);
+    QFETCH(int, caseSensitivity);
+
+    if (size > 1000000 && qgetenv(hugeVariable).isEmpty())
+        QSKIP("Set UIHELPERS_BENCH_HUGE to run the 10M entries dictionary");
+
+    const QStringList words = dictionary(size);
+    run(words, words.at(size / 2), sorted, Qt::CaseSensitivity(caseSensitivity), measurement);
+}
+
+void tst_bench_UiCompletionModel::run(const QStringList &dictionaryWords, const QString &target,
+                                      bool sorted, Qt::CaseSensitivity cs, Measurement measurement)
+{
+    QStringList words = dictionaryWords;
+    UiCompletionModel::ModelSorting sorting = UiCompletionModel::UnsortedModel;
+    if (sorted && cs == Qt::CaseSensitive) {
+        qSort(words.begin(), words.end());
+        sorting = UiCompletionModel::CaseSensitivelySortedModel;
+    } else if (sorted) {
+        qSort(words.begin(), words.end(), caseInsensitiveLessThan);
+        sorting = UiCompletionModel::CaseInsensitivelySortedModel;
+    }
+
+    QStringListModel source(words);
+    UiCompletionModel model;
+    model.setSourceModel(&source);
+    model.setCaseSensitivity(cs);
+    model.setModelSorting(sorting);
+    UiCompletionEngine *engine = model.d_func()->engine.data();
+
+    const QStringList prefixes = keystrokes(target);
+
+    if (measurement == CacheMisses || measurement == Memory) {
+#ifdef QT_BUILD_INTERNAL
+        const int misses = engine->cacheMisses;
+#else
+        if (measurement == CacheMisses)
+            QSKIP("Cache statistics are only kept in developer builds");
+#endif
+        foreach (const QString &prefix, prefixes) {
+            model.setCompletionPrefix(prefix);
+            model.rowCount();
+        }
+#ifdef QT_BUILD_INTERNAL
+        if (measurement == CacheMisses)
+            QTest::setBenchmarkResult(engine->cacheMisses - misses, QTest::Events);
+#endif
+        if (measurement == Memory)
+            QTest::setBenchmarkResult(engine->memoryCost(), QTest::BytesAllocated);
+        return;
+    }
+
+    // Each iteration is one keystroke of the typing and erasing sequence
+    int stroke = 0;
+    QBENCHMARK {
+        if (measurement == ColdTyping && stroke == 0)
+            model.invalidate();
+        model.setCompletionPrefix(prefixes.at(stroke));
+        model.rowCount(); // what a view asks for first
+        stroke = (stroke + 1) % prefixes.count();
+    }
+}
+
+void tst_bench_UiCompletionModel::typing_data()
+{
+    addSyntheticRows();
+}
+
+void tst_bench_UiCompletionModel::typing()
+{
+    runSynthetic(Typing);
+}
+
+void tst_bench_UiCompletionModel::coldTyping_data()
+{
+    addSyntheticRows();
+}
+
+// Every typing sequence starts with empty caches, as after a source change
+void tst_bench_UiCompletionModel::coldTyping()
+{
+    runSynthetic(ColdTyping);
+}
+
+void tst_bench_UiCompletionModel::cacheMisses_data()
+{
+    addSyntheticRows();
+}
+
+// Match cache misses over one typing sequence
+void tst_bench_UiCompletionModel::cacheMisses()
+{
+    runSynthetic(CacheMisses);
+}
+
+void tst_bench_UiCompletionModel::memory_data()
+{
+    addSyntheticRows();
+}
+
+// Memory held by the engine after one typing sequence
+void tst_bench_UiCompletionModel::memory()
+{
+    runSynthetic(Memory);
+}
+
+void tst_bench_UiCompletionModel::realDictionary_data()
+{
+    QTest::addColumn<QString>("fileName");
+    QTest::addColumn<QString>("target");
+    QTest::addColumn<int>("caseSensitivity");
+
+    const QString countries = QLatin1String(SRCDIR "../../../examples/shared/countries.txt");
+    const QString words = QLatin1String("/usr/share/dict/words");
+    QTest::newRow("countries sensitive") << countries << "United Kingdom" << int(Qt::CaseSensitive);
+    QTest::newRow("countries insensitive") << countries << "united kingdom" << int(Qt::CaseInsensitive);
+    QTest::newRow("words sensitive") << words << "internationalization" << int(Qt::CaseSensitive);
+    QTest::newRow("words insensitive") << words << "Internationalization" << int(Qt::CaseInsensitive);
+}
+
+void tst_bench_UiCompletionModel::realDictionary()
+{
+    QFETCH(QString, fileName);
+    QFETCH(QString, target);
+    QFETCH(int, caseSensitivity);
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        QSKIP("Dictionary not available");
+    const QStringList words = QString::fromUtf8(file.readAll()).split(QLatin1Char('\n'), QString::SkipEmptyParts);
+    run(words, target, false, Qt::CaseSensitivity(caseSensitivity), Typing);
+}
+
+QTEST_MAIN(tst_bench_UiCompletionModel)
+#include "tst_bench_uicompletionmodel.moc"
@@ -0,0 +1,8 @@
+TEMPLATE = app
+TARGET = tst_bench_uicompletionmodel
+
+QT += testlib uihelpers uihelpers-private core-private gui-private
+
+SOURCES += tst_bench_uicompletionmodel.cpp
+
+DEFINES += SRCDIR=\\\"$$PWD/\\\"
@@ -0,0 +1,184 @@
+/****************************************************************************
+**
+** Copyright (C) 2012 Instituto Nokia de Tecnologia (INdT)
+** Contact: http://www.qt-project.org/
+**
+** This file is part of the UiHelpers playground module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** GNU Lesser General Public License Usage
+** This file may be used under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation and
+** appearing in the file LICENSE.LGPL included in the packaging of this
+** file. Please review the following information to ensure the GNU Lesser
+** General Public License version 2.1 requirements will be met:
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Nokia gives you certain additional
+** rights. These rights are described in the Nokia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU General
+** Public License version 3.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this
+** file. Please review the following information to ensure the GNU General
+** Public License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** Other Usage
+** Alternatively, this file may be used in accordance with the terms and
+** conditions contained in a signed written agreement between you and Nokia.
+**
+**
+**
+**
+**
+**
+** $QT_END_LICENSE$
+**
+
+#include <QtTest/QtTest>
+#include <private/uifilesystemmodel_p.h>
+
+#if defined(__GLIBC__)
+#  include <malloc.h>
+#endif
+
+QT_USE_NAMESPACE_UIHELPERS
+
+typedef UiFileSystemModelPrivate::QFileSystemNode Node;
+
+class FriendFileSystemModel : public UiFileSystemModel
+{
+    friend class tst_bench_UiFileSystemModel;
+    Q_DECLARE_PRIVATE(UiFileSystemModel)
+};
+
+class tst_bench_UiFileSystemModel : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void nodeMemory_data();
+    void nodeMemory();
+    void refilter_data();
+    void refilter();
+};
+
+// Bytes the heap has handed out and not got back, big blocks included,
+// -1 if that can't be told
+static qint64 heapInUse()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    const struct mallinfo2 m = mallinfo2();
+    return qint64(m.uordblks) + qint64(m.hblkhd);
+#elif defined(__GLIBC__)
+    const struct mallinfo m = mallinfo();
+    return qint64(m.uordblks) + qint64(m.hblkhd);
+#else
+    return -1;
+#endif
+}
+
+void tst_bench_UiFileSystemModel::nodeMemory_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+}
+
+/*
+    Measures what a directory of files costs the model, the way it holds
+    them: a node per file, its name shared with the name index of the
+    directory, its information with the type name shared by all, and its
+    place among the visible children.
+*/
+void tst_bench_UiFileSystemModel::nodeMemory()
+{
+    QFETCH(int, size);
+    if (heapInUse() < 0)
+        QSKIP("Heap usage can only be measured with glibc");
+
+    const QString displayType = QString::fromLatin1("txt File");
+    UiExtendedInformation info;
+    info.setStat(UiExtendedInformation::File, 1024, 0, QFile::ReadUser | QFile::WriteUser, false, false);
+    info.displayType = displayType;
+
+    const qint64 before = heapInUse();
+    // as they come from the gatherer
+    QStringList names;
+    names.reserve(size);
+    for (int i = 0; i < size; ++i)
+        names.append(QString::fromLatin1("file%1.txt").arg(i));
+    Node *directory = new Node(QString::fromLatin1("directory"));
+    for (int i = 0; i < size; ++i) {
+        Node *node = new Node(names.at(i), directory);
+        node->populate(info);
+        directory->children.insert(names.at(i), node);
+        node->visibleIndex = directory->visibleChildren.count();
+        directory->visibleChildren.append(node);
+        node->isVisible = true;
+    }
+    // leaving the names to the nodes
+    names.clear();
+    const qint64 bytes = heapInUse() - before;
+    delete directory;
+
+    const qint64 perFile = bytes / size;
+    qDebug("%lld bytes per file, %d of them the node itself", perFile, int(sizeof(Node)));
+    QTest::setBenchmarkResult(perFile, QTest::BytesAllocated);
+}
+
+void tst_bench_UiFileSystemModel::refilter_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<bool>("nameFilters");
+    QTest::newRow("10k") << 10000 << false;
+    QTest::newRow("10k, name filters") << 10000 << true;
+    QTest::newRow("50k") << 50000 << false;
+    QTest::newRow("50k, name filters") << 50000 << true;
+}
+
+/*
+    Measures what refilter() costs the GUI thread for a directory large
+    enough to be filtered on the thread pool: counting the children and
+    taking the snapshot of them. The filtering itself runs elsewhere and
+    is cancelled right away.
+*/
+void tst_bench_UiFileSystemModel::refilter()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(int, size);
+    QFETCH(bool, nameFilters);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    for (int i = 0; i < size; ++i) {
+        QFile file(dir.path() + QString::fromLatin1("/file%1.txt").arg(i));
+        QVERIFY(file.open(QIODevice::WriteOnly));
+    }
+
+    FriendFileSystemModel model;
+    UiFileSystemModelPrivate *d = model.d_func();
+    const QModelIndex root = model.setRootPath(dir.path());
+    QTRY_COMPARE_WITH_TIMEOUT(model.rowCount(root), size, 60000);
+    if (nameFilters) {
+        model.setNameFilterDisables(false);
+        model.setNameFilters(QStringList() << QString::fromLatin1("*.txt"));
+    }
+    // a sort that is still due would take the place of the refilter
+    model.sort(0);
+    QVERIFY(!d->forceSort);
+
+    QBENCHMARK {
+        d->refilter();
+        d->cancelRefilter();
+    }
+#else
+    QSKIP("The model's internals are only exported by developer builds");
+#endif
+}
+
+QTEST_MAIN(tst_bench_UiFileSystemModel)
+#include "tst_bench_uifilesystemmodel.moc"
@@ -0,0 +1,6 @@
+TEMPLATE = app
+TARGET = tst_bench_uifilesystemmodel
+
+QT += testlib uihelpers uihelpers-private core-private
+
+SOURCES += tst_bench_uifilesystemmodel.cpp